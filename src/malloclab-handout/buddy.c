@@ -0,0 +1,557 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "buddy.h"
+#include "memlib.h"
+#include "utils.h"
+
+#include "config.h"
+
+/* binary buddy: the heap is cut into blocks of 2^k bytes, MIN_ORDER <= k <= MAX_ORDER, each of them
+ * aligned to its size relative to buddy_base. the buddy of a block is the other half of the block it
+ * was split from, at offset ^ 2^k, so a free block finds the one to merge with by a single xor.
+ * the header holds the order of the block, a free block is linked in the free area of its order.
+ *
+ * alloc:   |hdr|          payload          |
+ * free:    |hdr|next|prev|     ......      |
+ * */
+#define MIN_ORDER       4                               /* 16 bytes, room for a header and two links */
+#define MAX_ORDER       24                              /* 16MB, the largest block of a MAX_HEAP heap */
+#define ORDER_NUM       (MAX_ORDER - MIN_ORDER + 1)
+#define ORDER_IDX(k)    ((k) - MIN_ORDER)
+
+#define ORDER_SIZE(k)   ((size_t) 1 << (k))            /* block size of order k */
+
+/* padding block, so that a payload after a 4 bytes header is 8 bytes aligned */
+#define PADDING_BLK_SIZE    4
+
+#define BLK_HDR_SIZE    4
+
+#define GET(p)          (*(unsigned int*)(p))
+#define SET(p, val)     (*(unsigned int*)(p) = (val))
+
+#define BLK_HDRP(p)     ((char *) (p) - BLK_HDR_SIZE)
+#define BLK_ORDER(p)    ((int) GET(BLK_HDRP(p)))
+#define SET_ORDER(p, k) SET(BLK_HDRP(p), (k))
+
+#define BLK_OFF(p)      ((size_t) (BLK_HDRP(p) - (char *) buddy_base))     /* offset of the block p */
+#define BLK_AT(off)     ((void *) ((char *) buddy_base + (off) + BLK_HDR_SIZE))  /* the block at offset off */
+#define BUDDY_OFF(off, k)   ((off) ^ ORDER_SIZE(k))                        /* offset of the buddy */
+
+/* free block pointers: 32 bit offsets from buddy_base, like segregate, so that a MIN_ORDER block
+ * has room for both links. offset 0 is NULL, no payload lives there */
+#define FREE_OFFSET(p)          ((p) == NULL ? 0 : (unsigned int) ((char *) (p) - (char *) buddy_base))
+#define FREE_PTR(off)           ((off) == 0 ? NULL : (void *) ((char *) buddy_base + (off)))
+
+#define NEXT_FREE_BLKP(p)       FREE_PTR(*(unsigned int *) (p))
+#define PREV_FREE_BLKP(p)       FREE_PTR(*((unsigned int *) (p) + 1))
+
+#define SET_NEXT_FREE_BLK(bp, next)    (*(unsigned int *) (bp) = FREE_OFFSET(next))
+#define SET_PREV_FREE_BLK(bp, prev)    (*((unsigned int *) (bp) + 1) = FREE_OFFSET(prev))
+
+/* split/merge bitmap: one bit per buddy pair of every order but MAX_ORDER, that is the number of
+ * free blocks of the pair, mod 2. it is flipped whenever a block of the pair enters or leaves its
+ * free area, so a block just freed whose bit turns 0 has a free buddy to merge with. a buddy beyond
+ * the brk never counts. like the free area maps of a kernel it covers the whole MAX_HEAP, and lives
+ * out of the heap. */
+#define PAIR_BITS(k)    ((MAX_HEAP >> ((k) + 1)) + 1)                      /* pairs of order k */
+#define BUDDY_MAP_SIZE  ((MAX_HEAP >> MIN_ORDER) / 8 + ORDER_NUM)
+
+#define PAIR_IDX(off, k)    (map_start[ORDER_IDX(k)] + ((off) >> ((k) + 1)))
+#define PAIR_FREE(off, k)   ((buddy_map[PAIR_IDX(off, k) / 8] >> (PAIR_IDX(off, k) % 8)) & 1)
+
+void buddy_dump(char *msg, size_t size, void *p);
+
+static void *map_alloc(size_t size);
+
+static void *map_realloc(void *ptr, size_t size);
+
+static void map_free(void *ptr);
+
+static void *buddy_base;                    /* offsets of the blocks are relative to it */
+static size_t buddy_top;                    /* offset of the brk */
+static void *free_area[ORDER_NUM];          /* free blocks, one list per order */
+static unsigned int free_area_map;          /* non-empty free areas */
+static size_t map_start[ORDER_NUM];         /* first bit of every order in buddy_map */
+static uint8_t buddy_map[BUDDY_MAP_SIZE];   /* see PAIR_FREE() */
+
+#ifdef THREAD_SAFE
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;     /* guards the whole heap */
+#endif
+
+/******************************************
+ * free areas
+ ******************************************/
+
+/**
+ *
+ * @param bp a free block
+ * @param k its order
+ */
+void free_area_insert(void *bp, int k) {
+    void *nextp;
+
+    nextp = free_area[ORDER_IDX(k)];
+    SET_NEXT_FREE_BLK(bp, nextp);
+    SET_PREV_FREE_BLK(bp, NULL);
+    if (nextp != NULL) {
+        SET_PREV_FREE_BLK(nextp, bp);
+    }
+    free_area[ORDER_IDX(k)] = bp;
+    free_area_map |= 1u << ORDER_IDX(k);
+}
+
+/**
+ *
+ * @param bp a free block in the free area of order k
+ * @param k
+ */
+void free_area_del(void *bp, int k) {
+    void *prevp, *nextp;
+
+    prevp = PREV_FREE_BLKP(bp);
+    nextp = NEXT_FREE_BLKP(bp);
+    if (prevp != NULL) {
+        SET_NEXT_FREE_BLK(prevp, nextp);
+    } else if ((free_area[ORDER_IDX(k)] = nextp) == NULL) {
+        free_area_map &= ~(1u << ORDER_IDX(k));
+    }
+    if (nextp != NULL) {
+        SET_PREV_FREE_BLK(nextp, prevp);
+    }
+}
+
+/**
+ * Flip the bit of the pair of the block at offset off, when the block enters or leaves its free area
+ * @param off
+ * @param k
+ * @return the new bit, 0 if the buddy is free as well. always 1 for MAX_ORDER, which has no buddy
+ */
+int pair_toggle(size_t off, int k) {
+    size_t i;
+
+    if (k >= MAX_ORDER) {
+        return 1;
+    }
+    i = PAIR_IDX(off, k);
+    buddy_map[i / 8] ^= 1u << (i % 8);
+    return (buddy_map[i / 8] >> (i % 8)) & 1;
+}
+
+/******************************************
+ * helper functions
+ ******************************************/
+
+/**
+ * The order of the smallest block for size bytes
+ * @param size
+ * @return
+ */
+int buddy_order(size_t size) {
+    size_t need;
+
+    need = size + BLK_HDR_SIZE;
+    if (need <= ORDER_SIZE(MIN_ORDER)) {
+        return MIN_ORDER;
+    }
+    return 64 - __builtin_clzll(need - 1);
+}
+
+/**
+ * Free the block p of order k, merging it with its buddy as long as the buddy is free too
+ * @param p
+ * @param k
+ */
+void buddy_release(void *p, int k) {
+    size_t off;
+
+    off = BLK_OFF(p);
+    while (pair_toggle(off, k) == 0) {
+        /* taking the buddy out flips the bit back, and p does not enter this free area either */
+        free_area_del(BLK_AT(BUDDY_OFF(off, k)), k);
+        off &= ~ORDER_SIZE(k);
+        k++;
+    }
+
+    p = BLK_AT(off);
+    SET_ORDER(p, k);
+    free_area_insert(p, k);
+}
+
+/**
+ * Extend the heap for a block of order k
+ * @param k
+ * @return an alloc block of order k, or NULL if failed
+ */
+void *buddy_extend(int k) {
+    // 1. a block of order k starts at a multiple of 2^k, so fill the gap up to there with
+    //    the largest aligned free blocks, which may merge with free blocks below;
+    // 2. the new block goes right after.
+    void *p;
+    int j;
+
+#ifdef DEBUG
+    printf("[DEBUG] in buddy_extend(), order = %d\n", k);
+#endif
+
+    /* the pair map covers MAX_HEAP, however large mem_maxheap() is */
+    if (((buddy_top + ORDER_SIZE(k) - 1) & ~(ORDER_SIZE(k) - 1)) + ORDER_SIZE(k) > MAX_HEAP) {
+        return NULL;
+    }
+
+    while ((buddy_top & (ORDER_SIZE(k) - 1)) != 0) {
+        j = __builtin_ctzll(buddy_top);
+        if (mem_sbrk(ORDER_SIZE(j)) == (void *) -1) {
+            return NULL;
+        }
+        p = BLK_AT(buddy_top);
+        buddy_top += ORDER_SIZE(j);
+        buddy_release(p, j);
+    }
+
+    if (mem_sbrk(ORDER_SIZE(k)) == (void *) -1) {
+        return NULL;
+    }
+    p = BLK_AT(buddy_top);
+    buddy_top += ORDER_SIZE(k);
+    SET_ORDER(p, k);
+    return p;
+}
+
+/**
+ * Grow the block ptr of order k to order nk where it is. every buddy on the way up must be
+ * the upper half, and either free or beyond the brk, which is then extended
+ * @param ptr
+ * @param k
+ * @param nk
+ * @return ptr, or NULL if it cannot grow in place
+ */
+void *buddy_grow(void *ptr, int k, int nk) {
+    size_t off, qoff, end;
+    int j;
+
+    off = BLK_OFF(ptr);
+    end = off + ORDER_SIZE(nk);
+    if (end > MAX_HEAP) {
+        return NULL;
+    }
+    for (j = k; j < nk; j++) {
+        qoff = off + ORDER_SIZE(j);
+        if ((off & ORDER_SIZE(j)) != 0 || (qoff < buddy_top && !PAIR_FREE(off, j))) {
+            return NULL;
+        }
+    }
+
+    if (end > buddy_top) {
+        if (mem_sbrk(end - buddy_top) == (void *) -1) {
+            return NULL;
+        }
+    }
+
+    for (j = k; j < nk && (qoff = off + ORDER_SIZE(j)) < buddy_top; j++) {
+        free_area_del(BLK_AT(qoff), j);
+        pair_toggle(qoff, j);
+    }
+    if (end > buddy_top) {
+        buddy_top = end;
+    }
+
+    SET_ORDER(ptr, nk);
+    return ptr;
+}
+
+/******************************************
+ * allocator core
+ * NOTE: callers must hold the heap_lock
+ ******************************************/
+
+/**
+ *
+ * @return
+ */
+static int buddy_init(void) {
+    int k;
+
+    /* NOTE: no block at offset 0 of the heap, but the padding */
+    if ((buddy_base = mem_sbrk(PADDING_BLK_SIZE)) == (void *) -1) {
+        return 1;
+    }
+    SET(buddy_base, 0xDEADBEEF);
+    buddy_base += PADDING_BLK_SIZE;
+    buddy_top = 0;
+
+    memset(free_area, 0, sizeof(free_area));
+    free_area_map = 0;
+    memset(buddy_map, 0, sizeof(buddy_map));
+    for (k = MIN_ORDER, map_start[0] = 0; k < MAX_ORDER; k++) {
+        map_start[ORDER_IDX(k) + 1] = map_start[ORDER_IDX(k)] + PAIR_BITS(k);
+    }
+
+    return 0;
+}
+
+/**
+ *
+ * @param size
+ * @return
+ */
+static void *buddy_malloc(size_t size) {
+    // 1. take the smallest free block of order k at least, or extend the heap if none;
+    // 2. split it down to order k, the upper halves go to the free areas.
+    void *p, *q;
+    unsigned int map;
+    int k, j;
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    /* large blocks stay out of the heap */
+    if (MAP_HOLDS(size)) {
+        return map_alloc(size);
+    }
+
+    if ((k = buddy_order(size)) > MAX_ORDER) {
+        return NULL;
+    }
+
+    if ((map = free_area_map >> ORDER_IDX(k)) == 0) {
+        p = buddy_extend(k);
+#ifdef DUMP_HEAP
+        buddy_dump("alloc from heap", size, p);
+#endif
+        return p;
+    }
+
+    j = k + __builtin_ctz(map);
+    p = free_area[ORDER_IDX(j)];
+    free_area_del(p, j);
+    pair_toggle(BLK_OFF(p), j);
+
+    while (j > k) {
+        j--;
+        q = BLK_AT(BLK_OFF(p) + ORDER_SIZE(j));
+        SET_ORDER(q, j);
+        free_area_insert(q, j);
+        pair_toggle(BLK_OFF(q), j);
+    }
+    SET_ORDER(p, k);
+
+#ifdef DUMP_HEAP
+    buddy_dump("alloc", size, p);
+#endif
+    return p;
+}
+
+/**
+ *
+ * @param ptr
+ */
+static void buddy_free(void *ptr) {
+    if (MAP_OWNS(ptr)) {
+        map_free(ptr);
+        return;
+    }
+
+    buddy_release(ptr, BLK_ORDER(ptr));
+#ifdef DUMP_HEAP
+    buddy_dump("free", 0, ptr);
+#endif
+}
+
+/**
+ *
+ * @param ptr
+ * @param size
+ * @return
+ */
+static void *buddy_realloc(void *ptr, size_t size) {
+    void *np;
+    int k, nk;
+
+    if (ptr == NULL) {
+        return buddy_malloc(size);
+    }
+
+    if (size == 0) {
+        buddy_free(ptr);
+        return NULL;
+    }
+
+    if (MAP_OWNS(ptr)) {
+        return map_realloc(ptr, size);
+    }
+
+    k = BLK_ORDER(ptr);
+    nk = buddy_order(size);
+
+    /* shrink, the upper halves go back to the free areas */
+    if (nk <= k) {
+        while (k > nk) {
+            k--;
+            buddy_release(BLK_AT(BLK_OFF(ptr) + ORDER_SIZE(k)), k);
+        }
+        SET_ORDER(ptr, k);
+        return ptr;
+    }
+
+    /* grow, copy only if the buddies are in the way */
+    if (!MAP_HOLDS(size) && buddy_grow(ptr, k, nk) != NULL) {
+#ifdef DUMP_HEAP
+        buddy_dump("grow in place", size, ptr);
+#endif
+        return ptr;
+    }
+
+    if ((np = buddy_malloc(size)) == NULL) {
+        return NULL;
+    }
+    memcpy(np, ptr, ORDER_SIZE(k) - BLK_HDR_SIZE);
+    buddy_free(ptr);
+    return np;
+}
+
+/******************************************
+ * mapped blocks
+ * NOTE: callers must hold the heap_lock
+ ******************************************/
+
+/**
+ * Map a region of its own for a large block
+ * @param size
+ * @return the payload, or NULL if failed
+ */
+static void *map_alloc(size_t size) {
+    void *p;
+    size_t len;
+
+    len = MAP_NEED_LEN(size);
+    if ((p = mem_map(len)) == (void *) -1) {
+        return NULL;
+    }
+    p += MAP_HDR_SIZE;
+    MAP_LEN(p) = len;
+    return p;
+}
+
+/**
+ * Give the whole region of a mapped block back
+ * @param ptr
+ */
+static void map_free(void *ptr) {
+    mem_unmap(ptr - MAP_HDR_SIZE);
+}
+
+/**
+ * Resize a mapped block: remap it while it is still large, or move it into the heap
+ * @param ptr
+ * @param size
+ * @return
+ */
+static void *map_realloc(void *ptr, size_t size) {
+    void *p;
+    size_t len;
+
+    if (MAP_HOLDS(size)) {
+        if ((len = MAP_NEED_LEN(size)) == MAP_LEN(ptr)) {
+            return ptr;
+        }
+        if ((p = mem_remap(ptr - MAP_HDR_SIZE, len)) == (void *) -1) {
+            return NULL;
+        }
+        p += MAP_HDR_SIZE;
+        MAP_LEN(p) = len;
+        return p;
+    }
+
+    if ((p = buddy_malloc(size)) == NULL) {
+        return NULL;
+    }
+    memcpy(p, ptr, size);
+    map_free(ptr);
+    return p;
+}
+
+/******************************************
+ * allocator open APIs
+ ******************************************/
+
+/**
+ *
+ * @return
+ */
+int buddy_mm_init(void) {
+    int ret;
+
+    MM_LOCK(&heap_lock);
+    ret = buddy_init();
+    MM_UNLOCK(&heap_lock);
+
+    return ret;
+}
+
+/**
+ *
+ * @param size
+ * @return
+ */
+void *buddy_mm_malloc(size_t size) {
+    void *p;
+
+    MM_LOCK(&heap_lock);
+    p = buddy_malloc(size);
+    MM_UNLOCK(&heap_lock);
+
+    return p;
+}
+
+/**
+ *
+ * @param ptr
+ */
+void buddy_mm_free(void *ptr) {
+    MM_LOCK(&heap_lock);
+    buddy_free(ptr);
+    MM_UNLOCK(&heap_lock);
+}
+
+/**
+ *
+ * @param ptr
+ * @param size
+ * @return
+ */
+void *buddy_mm_realloc(void *ptr, size_t size) {
+    void *p;
+
+    MM_LOCK(&heap_lock);
+    p = buddy_realloc(ptr, size);
+    MM_UNLOCK(&heap_lock);
+
+    return p;
+}
+
+/******************************************
+ * free area dumper
+ ******************************************/
+void buddy_dump(char *msg, size_t size, void *p) {
+    void *bp;
+    int k;
+
+    printf("\n");
+    printf("after %s %d(0x%x) memory at %p, heap top at offset 0x%zx:\n", msg, (int) size, (int) size, p, buddy_top);
+    printf("==========================================================================================\n");
+    for (k = MIN_ORDER; k <= MAX_ORDER; k++) {
+        if ((bp = free_area[ORDER_IDX(k)]) == NULL) {
+            continue;
+        }
+
+        printf("order [%d]:\t", k);
+        for (; bp != NULL; bp = NEXT_FREE_BLKP(bp)) {
+            printf("0x%zx\t", BLK_OFF(bp));
+        }
+        printf("\n");
+    }
+    printf("==========================================================================================\n");
+}
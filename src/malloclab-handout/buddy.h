@@ -0,0 +1,16 @@
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include <stdlib.h>
+
+extern int mm_init (void);
+extern void *mm_malloc (size_t size);
+extern void mm_free (void *ptr);
+extern void *mm_realloc(void *ptr, size_t size);
+
+int buddy_mm_init(void);
+void *buddy_mm_malloc(size_t size);
+void buddy_mm_free(void *ptr);
+void *buddy_mm_realloc(void *ptr, size_t size);
+
+#endif //_BUDDY_H
@@ -17,68 +17,163 @@
  * make us save some bytes.
  *
  * NOTE: if a block has 0 byte, IT MUST BE MARKED AS FREE
+ *
+ * with an explicit free list, a free block must have room for the links.
  * */
+#ifdef USE_EXPLICIT_LIST
+#define MIN_BLK_SIZE    (RB_HDR_SIZE + 2 * sizeof(void *) + RB_FTR_SIZE)
+#else
 #define MIN_BLK_SIZE    (RB_HDR_SIZE + RB_FTR_SIZE)
+#endif
 
 #define BLK_FREE    0
 #define BLK_ALLOC   1
 
-#define PACK(size, alloc) ((size) | (alloc))    /* pack size with alloc */
+/* only free blocks have a footer, bit 1 of a header tells if the previous block is alloced,
+ * so that coalesce() knows whether there is a footer to look for
+ *
+ * alloc:   |hdr|          payload          |
+ * free:    |hdr|                       |ftr|
+ * */
+#define PACK(size, prev_alloc, alloc) ((size) | ((prev_alloc) << 1) | (alloc))    /* pack size with alloc states */
+
+#define GET(p)          (*(blk_word_t *)(p))
+#define SET(p, val)     (*(blk_word_t *)(p) = (val))
 
-#define GET(p)          (*(unsigned int*)(p))
-#define SET(p, val)     (*(unsigned int*)(p) = (val))
+#define GET_SIZE(p)         (GET(p) & ~0x7)
+#define GET_ALLOC(p)        (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p)   ((GET(p) >> 1) & 0x1)
 
-#define GET_SIZE(p)     (GET(p) & ~0x7)
-#define GET_ALLOC(p)    (GET(p) & 0x1)
+/* bit 2 of an alloc block header is set once the block has grown on realloc, see GROW_SIZE().
+ * any SET_RB() clears it */
+#define RB_GROWN_BIT        0x4
+#define RB_GROWN(p)         (GET(RB_HDRP(p)) & RB_GROWN_BIT)
+#define SET_GROWN(p)        SET(RB_HDRP(p), GET(RB_HDRP(p)) | RB_GROWN_BIT)
 
 /* padding block */
-#define PADDING_BLK_SIZE 4
+#define PADDING_BLK_SIZE BLK_WORD_SIZE
 
 /* prologue block */
-#define PB_HDR_SIZE 4
-#define PB_FTR_SIZE 4
+#define PB_HDR_SIZE BLK_WORD_SIZE
+#define PB_FTR_SIZE BLK_WORD_SIZE
 
 /* epilogue block */
-#define EB_HDR_SIZE 4
+#define EB_HDR_SIZE BLK_WORD_SIZE
 
 #define EB_HDRP(p)      ((void*)(p) - EB_HDR_SIZE)          /* epilogue block header pointer */
-#define SET_EB(p)       SET(EB_HDRP(p), PACK(0, 1))         /* set epilogue block */
+#define SET_EB(p)       SET(EB_HDRP(p), PACK(0, 1, 1))      /* set epilogue block, behind an alloc one */
 #define EB(p)           (GET_SIZE(EB_HDRP(p)) == 0)         /* does p point to a epilogue block? */
 
 /* regular block */
-#define RB_HDR_SIZE 4
-#define RB_FTR_SIZE 4
+#define RB_HDR_SIZE BLK_WORD_SIZE
+#define RB_FTR_SIZE BLK_WORD_SIZE
+#define RB_MAX_SIZE ((size_t) (blk_word_t) ~0x7)                    /* the largest size a header holds */
 
 #define RB_ALLOC(p)     (GET_ALLOC(RB_HDRP(p)))                 /* is the block alloced? */
 #define RB_SIZE(p)      (GET_SIZE(RB_HDRP(p)))                  /* total size of this block, including header and footer */
-#define RB_AVL_SIZE(p)  (RB_SIZE(p) - RB_HDR_SIZE - RB_FTR_SIZE)    /* available memory size */
+#define RB_AVL_SIZE(p)  (RB_SIZE(p) - RB_HDR_SIZE)              /* available memory size once alloced */
 
-#define RB_HDRP(p) ((void*)(p) - RB_HDR_SIZE)       /* regular block header pointer */
-#define RB_FTRP(p) ((void*)(p) + RB_AVL_SIZE(p))    /* regular block footer pointer */
+#define RB_HDRP(p) ((void*)(p) - RB_HDR_SIZE)                           /* regular block header pointer */
+#define RB_FTRP(p) ((void*)(p) + RB_SIZE(p) - RB_HDR_SIZE - RB_FTR_SIZE) /* regular block footer pointer, free blocks only */
 
 #define RB_NEXT_HDRP(p) RB_HDRP((void*)(p) + RB_SIZE(p))            /* next block header pointer */
-#define RB_PREV_FTRP(p) ((void*)(p) - RB_HDR_SIZE - RB_FTR_SIZE)    /* prev block footer pointer */
+#define RB_PREV_FTRP(p) ((void*)(p) - RB_HDR_SIZE - RB_FTR_SIZE)    /* prev block footer pointer, if it is free */
+
+/* set the block p, whose header is already in place, keeping the alloc state of its prev block */
+#define SET_RB(p, size, alloc)  SET_RB2(p, size, PREV_BLK_ALLOC(p), alloc)
 
-#define SET_RB(p, size, alloc) do {                     \
-    SET(RB_HDRP(p), PACK(size, alloc));                 \
-    SET(RB_FTRP(p), PACK(size, alloc)); } while(0)
+/* set the block p from scratch */
+#define SET_RB2(p, size, prev_alloc, alloc) do {        \
+    SET(RB_HDRP(p), PACK(size, prev_alloc, alloc));     \
+    if ((alloc) == BLK_FREE) {                          \
+        SET(RB_FTRP(p), PACK(size, 0, alloc));          \
+    } } while(0)
+
+/* tell the block p whether its prev block is alloced */
+#define SET_PREV_ALLOC(p, prev_alloc)   \
+    SET(RB_HDRP(p), (GET(RB_HDRP(p)) & ~0x2) | ((prev_alloc) << 1))
 
 /* pointer calculation */
-#define PREV_BLKP(p) ((void*)(p) - PREV_BLK_SIZE(p))    /* prev block pointer */
+#define PREV_BLKP(p) ((void*)(p) - PREV_BLK_SIZE(p))    /* prev block pointer, if it is free */
 #define NEXT_BLKP(p) ((void*)(p) + RB_SIZE(p))          /* next block pointer */
 
 /* block info */
-#define PREV_BLK_ALLOC(p)   GET_ALLOC(RB_PREV_FTRP(p))
+#define PREV_BLK_ALLOC(p)   GET_PREV_ALLOC(RB_HDRP(p))
 #define PREV_BLK_SIZE(p)    GET_SIZE(RB_PREV_FTRP(p))
 #define NEXT_BLK_ALLOC(p)   GET_ALLOC(RB_NEXT_HDRP(p))
 #define NEXT_BLK_SIZE(p)    GET_SIZE(RB_NEXT_HDRP(p))
 
-#define TAIL_BLK()     PREV_BLKP(mem_sbrk(0))          /* tailing block*/
+#define TAIL_FREE()    (PREV_BLK_ALLOC(mem_sbrk(0)) == BLK_FREE)    /* is the tailing block free? */
+#define TAIL_BLK()     PREV_BLKP(mem_sbrk(0))                       /* tailing block, if it is free */
+
+/* block size to alloc size bytes, big enough to be a free block later */
+#define RB_NEED_SIZE(size)  (ALIGN((size) + RB_HDR_SIZE) < MIN_BLK_SIZE ? MIN_BLK_SIZE : ALIGN((size) + RB_HDR_SIZE))
 
-void dump(char *, size_t, void *);
+/* explicit free list: free blocks are doubly linked through their payload, so the fit
+ * strategies only walk the free blocks. new free blocks go to the head of the list
+ * (USE_LIFO_ORDER), or where the list stays sorted by address (USE_ADDRESS_ORDER).
+ *
+ * |hdr|next|prev|   ......   |ftr|
+ * */
+#define NEXT_FREE_BLKP(p)   (*(void **) (p))
+#define PREV_FREE_BLKP(p)   (*((void **) (p) + 1))
+
+/* how the fit strategies walk the candidate blocks */
+#ifdef USE_EXPLICIT_LIST
+#define FIT_FIRST()     list_head
+#define FIT_END(p)      ((p) == NULL)
+#define FIT_NEXT(p)     NEXT_FREE_BLKP(p)
+#else
+#define FIT_FIRST()     heap_listp
+#define FIT_END(p)      EB(p)
+#define FIT_NEXT(p)     NEXT_BLKP(p)
+
+#define list_insert(bp)
+#define list_del(bp)
+#endif
+
+/* next fit over the whole heap, which goes on from heap_curp. heap_curp is kept up to date
+ * whatever the fit, as the fit is picked at runtime, see implicit_mm_set_fit() */
+#ifndef USE_EXPLICIT_LIST
+#define NEXT_FIT_ON_HEAP
+#endif
+
+/* the fit at startup, FIT in the Makefile */
+#if defined(USE_FIRST_FIT)
+#define FIT_DEFAULT     IMPLICIT_FIRST_FIT
+#elif defined(USE_NEXT_FIT)
+#define FIT_DEFAULT     IMPLICIT_NEXT_FIT
+#else
+#define FIT_DEFAULT     IMPLICIT_BEST_FIT
+#endif
+
+void implicit_dump(char *, size_t, void *);
+
+static void trim_heap(void *p);
+
+static void *map_alloc(size_t size);
+
+static void *map_realloc(void *ptr, size_t size);
+
+static void map_free(void *ptr);
 
 static void *heap_listp;    /* start point of the implicit heap list */
+static int heap_fit = FIT_DEFAULT;  /* one of IMPLICIT_*_FIT */
+
+#ifdef USE_EXPLICIT_LIST
+static void *list_head;     /* first free block */
+static void *list_curp;     /* where next fit starts, a free block or NULL */
+
+void list_insert(void *bp);
+
+void list_del(void *bp);
+#else
 static void *heap_curp;     /* current block pointer */
+#endif
+
+#ifdef THREAD_SAFE
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;     /* guards the whole heap */
+#endif
 
 /**
  * Try to place a block in bp
@@ -87,15 +182,14 @@ static void *heap_curp;     /* current block pointer */
  * @return
  */
 void *place(void *bp, size_t size) {
-    size_t asize, rsize, osize, nsize;
+    size_t rsize, osize, nsize;
     void *splitp;
 
     if (RB_ALLOC(bp) == BLK_ALLOC) {
         return NULL;
     }
 
-    asize = ALIGN(size);                                /* aligned size */
-    nsize = asize + RB_HDR_SIZE + RB_FTR_SIZE;          /* new block size */
+    nsize = RB_NEED_SIZE(size);                         /* new block size */
     osize = RB_SIZE(bp);                                /* old block size */
 
     /* no enough room */
@@ -103,22 +197,83 @@ void *place(void *bp, size_t size) {
         return NULL;
     }
 
+    list_del(bp);
     rsize = osize - nsize;                              /* remind size if the block will be split into 2 parts */
 
     /* cannot split */
     if (rsize < MIN_BLK_SIZE) {
         SET_RB(bp, osize, BLK_ALLOC);
+        SET_PREV_ALLOC(NEXT_BLKP(bp), BLK_ALLOC);
         return bp;
     }
 
     /* need to split */
     SET_RB(bp, nsize, BLK_ALLOC);
     splitp = NEXT_BLKP(bp);
-    SET_RB(splitp, rsize, BLK_FREE);
+    SET_RB2(splitp, rsize, BLK_ALLOC, BLK_FREE);
+    list_insert(splitp);
 
     return bp;
 }
 
+#ifdef USE_EXPLICIT_LIST
+/******************************************
+ * explicit free list
+ ******************************************/
+
+/**
+ *
+ * @param bp a free block
+ */
+void list_insert(void *bp) {
+    void *prevp, *nextp;
+
+    prevp = NULL;
+    nextp = list_head;
+#ifdef USE_ADDRESS_ORDER
+    while (nextp != NULL && nextp < bp) {
+        prevp = nextp;
+        nextp = NEXT_FREE_BLKP(nextp);
+    }
+#endif
+
+    NEXT_FREE_BLKP(bp) = nextp;
+    PREV_FREE_BLKP(bp) = prevp;
+    if (prevp != NULL) {
+        NEXT_FREE_BLKP(prevp) = bp;
+    } else {
+        list_head = bp;
+    }
+    if (nextp != NULL) {
+        PREV_FREE_BLKP(nextp) = bp;
+    }
+}
+
+/**
+ *
+ * @param bp a free block in the list
+ */
+void list_del(void *bp) {
+    void *prevp, *nextp;
+
+    prevp = PREV_FREE_BLKP(bp);
+    nextp = NEXT_FREE_BLKP(bp);
+    if (prevp != NULL) {
+        NEXT_FREE_BLKP(prevp) = nextp;
+    } else {
+        list_head = nextp;
+    }
+    if (nextp != NULL) {
+        PREV_FREE_BLKP(nextp) = prevp;
+    }
+
+    /* next fit goes on from where it left */
+    if (list_curp == bp) {
+        list_curp = nextp;
+    }
+}
+#endif
+
 /******************************************
  * fit strategies
  ******************************************/
@@ -135,15 +290,16 @@ void *first_fit(size_t size) {
 
     void *p;
 
-    p = heap_listp;
-    while (!EB(p)) {
+    p = FIT_FIRST();
+    while (!FIT_END(p)) {
         /* try to find a block that big enough
          * according to gprof, this is the most time-consuming
-         * code, cuz time:O(n) of this function for each hit */
+         * code, cuz time:O(n) of this function for each hit,
+         * unless there is an explicit free list */
         if (RB_ALLOC(p) == BLK_FREE && RB_AVL_SIZE(p) >= size) {
             return place(p, size);
         }
-        p = NEXT_BLKP(p);
+        p = FIT_NEXT(p);
     }
 
     return NULL;
@@ -155,11 +311,37 @@ void *first_fit(size_t size) {
  * @return
  */
 void *next_fit(size_t size) {
+    void *oldp, *p;
+
+#ifdef USE_EXPLICIT_LIST
 #ifdef DEBUG
-    printf("[DEBUG] in next_fit(), size = %ld, heap_curp =  %p\n", size, heap_curp);
+    printf("[DEBUG] in next_fit(), size = %ld, list_curp =  %p\n", size, list_curp);
 #endif
 
-    void *oldp, *p;
+    /* the list may be empty, so start from a free block rather than from the end */
+    if ((oldp = p = list_curp != NULL ? list_curp : list_head) == NULL) {
+        return NULL;
+    }
+
+    do {
+        if (RB_AVL_SIZE(p) >= size) {
+            /* go on from the remainder next time, as heap_curp does, or else from the block
+             * after p. the neighbours of a free block are alloced, so a free next is the remainder */
+            list_curp = NEXT_FREE_BLKP(p);
+            p = place(p, size);
+            if (NEXT_BLK_ALLOC(p) == BLK_FREE) {
+                list_curp = NEXT_BLKP(p);
+            }
+            return p;
+        }
+        if ((p = NEXT_FREE_BLKP(p)) == NULL) {
+            p = list_head;
+        }
+    } while (p != oldp);
+#else
+#ifdef DEBUG
+    printf("[DEBUG] in next_fit(), size = %ld, heap_curp =  %p\n", size, heap_curp);
+#endif
 
     oldp = p = NEXT_BLKP(heap_curp);
 
@@ -170,13 +352,14 @@ void *next_fit(size_t size) {
         } else {
             if (RB_ALLOC(p) == BLK_FREE && RB_AVL_SIZE(p) >= size) {
 #ifdef DEBUG
-                printf("[DEBUG] in next_fit(), FOUND! heap_curp =  %p\n", bp);
+                printf("[DEBUG] in next_fit(), FOUND! heap_curp =  %p\n", p);
 #endif
                 return place(p, size);
             }
             p = NEXT_BLKP(p);
         }
     } while (p != oldp);    /* stop if we return to the starting point */
+#endif
 
     return NULL;
 }
@@ -194,22 +377,22 @@ void *best_fit(size_t size) {
     void *p, *bestp;
     size_t best, nsize;
 
-    best = MAX_HEAP;        /* cannot bigger than the maxheap */
+    best = mem_maxheap();   /* cannot bigger than the maxheap */
     bestp = NULL;
-    p = heap_listp;
+    p = FIT_FIRST();
 
-    while (!EB(p)) {
+    while (!FIT_END(p)) {
         /* try to find a block that fits best */
         nsize = RB_AVL_SIZE(p);
         if (RB_ALLOC(p) == BLK_FREE && nsize >= size && nsize < best) {
             best = nsize;
             bestp = p;
         }
-        p = NEXT_BLKP(p);
+        p = FIT_NEXT(p);
     }
 
     /* find nothing fit */
-    if (best == MAX_HEAP) {
+    if (best == mem_maxheap()) {
         return NULL;
     }
 
@@ -226,13 +409,14 @@ void *find_fit(size_t size) {
     // 1. first fit
     // 2. next fit
     // 3. best fit
-#ifdef USE_FIRST_FIT
-    return first_fit(size);
-#elif USE_NEXT_FIT
-    return next_fit(size);
-#elif USE_BEST_FIT
-    return best_fit(size);
-#endif
+    switch (heap_fit) {
+        case IMPLICIT_FIRST_FIT:
+            return first_fit(size);
+        case IMPLICIT_NEXT_FIT:
+            return next_fit(size);
+        case IMPLICIT_BEST_FIT:
+            return best_fit(size);
+    }
     return NULL;
 }
 
@@ -245,14 +429,14 @@ void *find_fit(size_t size) {
  * @param bp
  * @return
  */
-void *coalesce(void *bp) {
+static void *coalesce(void *bp) {
     // four cases: (1 for alloc, 0 for free)
     // prev, now, next
     // 1, 0, 1
     // 0, 0, 1
     // 1, 0, 0
     // 0, 0, 0
-    int size;
+    size_t size;
     void *p;
 
     size = RB_SIZE(bp);
@@ -260,25 +444,33 @@ void *coalesce(void *bp) {
 
     if (NEXT_BLK_ALLOC(bp) == BLK_FREE) {
 #ifdef DEBUG
-        printf("[DEBUG] coalescing next block: %p, size: %d\n", NEXT_BLKP(bp), NEXT_BLK_SIZE(bp));
+        printf("[DEBUG] coalescing next block: %p, size: %zu\n", NEXT_BLKP(bp), (size_t) NEXT_BLK_SIZE(bp));
 #endif
+        list_del(NEXT_BLKP(bp));
         size += NEXT_BLK_SIZE(bp);
     }
 
     if (PREV_BLK_ALLOC(bp) == BLK_FREE) {
 #ifdef DEBUG
-        printf("[DEBUG] coalescing prev block: %p, size: %d\n", PREV_BLKP(bp), PREV_BLK_SIZE(bp));
+        printf("[DEBUG] coalescing prev block: %p, size: %zu\n", PREV_BLKP(bp), (size_t) PREV_BLK_SIZE(bp));
 #endif
+        list_del(PREV_BLKP(bp));
         size += PREV_BLK_SIZE(bp);
         p = PREV_BLKP(bp);
     }
 
     SET_RB(p, size, BLK_FREE);
+    SET_PREV_ALLOC(NEXT_BLKP(p), BLK_FREE);
+    list_insert(p);
+
+    if (TRIM_THRESHOLD > 0 && size > TRIM_THRESHOLD && EB(NEXT_BLKP(p))) {
+        trim_heap(p);
+    }
 
 #ifdef DUMP_HEAP
-    dump("coalesce", size, bp);
+    implicit_dump("coalesce", size, bp);
 #endif
-#ifdef USE_NEXT_FIT
+#ifdef NEXT_FIT_ON_HEAP
     heap_curp = p;
 #endif
     return p;
@@ -291,16 +483,17 @@ void *coalesce(void *bp) {
  * @param size: size of memory to extend the heap
  *              NOTE: it is caller's duty to rounds up to the nearest multiple of ALIGNMENT, and
  *                    it is caller's duty to calculate the header and footer within size
- * @return the address of free memory, or NULL if failed
+ * @return the address of free memory, which is an alloc block, or NULL if failed
  */
-void *extend_heap(int size) {
+static void *extend_heap(size_t size) {
 #ifdef DEBUG
-    printf("[DEBUG] in extend_heap(), size = %d\n", size);
+    printf("[DEBUG] in extend_heap(), size = %zu\n", size);
 #endif
 
     void *old_brkp;
 
-    if (size == 0) {
+    /* a size_t over INTPTR_MAX would be a shrink to mem_sbrk() */
+    if (size == 0 || size > INTPTR_MAX) {
         return NULL;
     }
 
@@ -309,52 +502,76 @@ void *extend_heap(int size) {
         return NULL;
     }
 
-    SET_EB(NEXT_BLKP(old_brkp));
+    /* the old epilogue becomes the header of the new block */
+    SET_RB2(old_brkp, size, PREV_BLK_ALLOC(old_brkp), BLK_ALLOC);
+    SET_EB(mem_sbrk(0));
 
     return old_brkp;
 }
 
+/**
+ * Shrink the heap
+ * Give the tailing free block p back to memlib, but for TRIM_PAD bytes of it
+ * @param p: a free block just before the epilogue, which stays where it is in the free list
+ */
+static void trim_heap(void *p) {
+    size_t size;
+
+    size = RB_SIZE(p) - TRIM_PAD;
+    if (mem_sbrk(-(intptr_t) size) == (void *) -1) {
+        return;
+    }
+
+#ifdef DEBUG
+    printf("[DEBUG] in trim_heap(), size = %zu\n", size);
+#endif
+    SET_RB(p, TRIM_PAD, BLK_FREE);
+    SET(EB_HDRP(mem_sbrk(0)), PACK(0, BLK_FREE, BLK_ALLOC));
+}
+
 /**
  *
- * @param size not contain header and footer
+ * @param size not contain header
  * @return
  */
 void *do_malloc(size_t size) {
     void *tailp, *curp;
-    size_t pasize, tsize;
+    size_t nsize, tsize;
 
-    size = ALIGN(size);
+    nsize = RB_NEED_SIZE(size);
 
     /* if no fitting block, try to extend the heap
      * wish we have free block at the tail of the heap that can be use
      * nor we have to alloc a totally new block for it */
-    tailp = TAIL_BLK();
-    if (RB_ALLOC(tailp) == BLK_FREE) {
+    if (TAIL_FREE()) {
 #ifdef DEBUG
         printf("[DEBUG] in do_malloc(): reuse tail block\n");
 #endif
-        pasize = RB_AVL_SIZE(tailp);        /* prev available memory size */
-        tsize = size - pasize;              /* we need to alloc */
+        tailp = TAIL_BLK();
+        if (RB_SIZE(tailp) >= nsize) {
+            /* the realloc copy path comes here without find_fit(), and the tail may do */
+            curp = place(tailp, size);
+        } else {
+            tsize = nsize - RB_SIZE(tailp);     /* we need to alloc */
+            if (extend_heap(tsize) == NULL) {
+                return NULL;
+            }
+            list_del(tailp);
 
-        if (extend_heap(tsize) == NULL) {
-            return NULL;
+            curp = tailp;
+            SET_RB(curp, nsize, BLK_ALLOC);
         }
-
-        curp = tailp;
     } else {
-        tsize = size + RB_HDR_SIZE + RB_FTR_SIZE;
-
-        if ((curp = extend_heap(tsize)) == NULL) {
+        if ((curp = extend_heap(nsize)) == NULL) {
             return NULL;
         }
+        SET_RB(curp, nsize, BLK_ALLOC);
     }
 
-    SET_RB(curp, size + RB_HDR_SIZE + RB_FTR_SIZE, BLK_ALLOC);
-
 #ifdef DUMP_HEAP
-    dump("alloc", size, curp);
+    implicit_dump("alloc", size, curp);
 #endif
-#ifdef USE_NEXT_FIT
+#ifdef NEXT_FIT_ON_HEAP
     heap_curp = curp;
 #endif
 
@@ -362,28 +579,38 @@ void *do_malloc(size_t size) {
 }
 
 /******************************************
- * allocator open APIs
+ * allocator core
+ * NOTE: callers must hold the heap_lock
  ******************************************/
 
 /**
  *
  * @return
  */
-int implicit_mm_init(void) {
-    if ((heap_listp = extend_heap(PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE + EB_HDR_SIZE)) == (void *) -1) {
+static int implicit_init(void) {
+    /* a free block may grow as large as the heap, and its size must fit in a header */
+    if (mem_maxheap() > RB_MAX_SIZE) {
+        return -1;
+    }
+
+    /* NOTE: nothing to tag in an empty heap, so mem_sbrk() rather than extend_heap() */
+    if ((heap_listp = mem_sbrk(PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE + EB_HDR_SIZE)) == (void *) -1) {
         return 1;
     }
 
     /* see CS:APP3e page 829 */
     SET(heap_listp, 0xDEADBEEF);
-    SET(heap_listp + PADDING_BLK_SIZE, PACK(PB_HDR_SIZE + PB_FTR_SIZE, BLK_ALLOC));
-    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE, PACK(PB_HDR_SIZE + PB_FTR_SIZE, BLK_ALLOC));
-    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE, PACK(0, BLK_ALLOC));
+    SET(heap_listp + PADDING_BLK_SIZE, PACK(PB_HDR_SIZE + PB_FTR_SIZE, BLK_ALLOC, BLK_ALLOC));
+    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE, PACK(PB_HDR_SIZE + PB_FTR_SIZE, BLK_ALLOC, BLK_ALLOC));
+    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE, PACK(0, BLK_ALLOC, BLK_ALLOC));
 
     heap_listp += PADDING_BLK_SIZE + PB_HDR_SIZE;
 
-#ifdef USE_NEXT_FIT
+#ifdef NEXT_FIT_ON_HEAP
     heap_curp = heap_listp;
+#endif
+#ifdef USE_EXPLICIT_LIST
+    list_head = list_curp = NULL;
 #endif
     return 0;
 }
@@ -393,26 +620,28 @@ int implicit_mm_init(void) {
  * @param size
  * @return
  */
-void *implicit_mm_malloc(size_t size) {
-    size_t asize;
+static void *implicit_malloc(size_t size) {
     void *curp;
 
     if (size == 0) {
         return NULL;
     }
 
-    asize = ALIGN(size);
+    /* large blocks stay out of the heap */
+    if (MAP_HOLDS(size)) {
+        return map_alloc(size);
+    }
 
     /* try to find a free block */
-    if ((curp = find_fit(asize)) != NULL) {
+    if ((curp = find_fit(size)) != NULL) {
 #ifdef DUMP_HEAP
-        dump("find fit", asize, cur);
+        implicit_dump("find fit", size, curp);
 #endif
     } else {
-        curp = do_malloc(asize);
+        curp = do_malloc(size);
     }
 
-#ifdef USE_NEXT_FIT
+#ifdef NEXT_FIT_ON_HEAP
     heap_curp = curp;
 #endif
     return curp;
@@ -422,10 +651,15 @@ void *implicit_mm_malloc(size_t size) {
  *
  * @param ptr
  */
-void implicit_mm_free(void *ptr) {
+static void implicit_free(void *ptr) {
+    if (MAP_OWNS(ptr)) {
+        map_free(ptr);
+        return;
+    }
+
     SET_RB(ptr, RB_SIZE(ptr), BLK_FREE);
 #ifdef DUMP_HEAP
-    dump("free", RB_SIZE(ptr), ptr);
+    implicit_dump("free", RB_SIZE(ptr), ptr);
 #endif
     coalesce(ptr);
 }
@@ -436,52 +670,56 @@ void implicit_mm_free(void *ptr) {
  * @param size
  * @return
  */
-void *implicit_mm_realloc(void *ptr, size_t size) {
+static void *implicit_realloc(void *ptr, size_t size) {
     void *p;                            /* new block pointer that we should return */
-    void *hdrp, *ftrp, *splitp;
+    void *hdrp, *splitp;
     void *prep;
-    size_t bsize, rsize, nsize, fsize;
+    size_t bsize, rsize, nsize, gsize, fsize;
     int alloc;
 
     /* equivalent to malloc */
     if (ptr == NULL) {
-        return implicit_mm_malloc(size);
+        return implicit_malloc(size);
     }
 
     /* equivalent to free */
     if (size == 0) {
-        implicit_mm_free(ptr);
+        implicit_free(ptr);
         return ptr;
     }
 
+    if (MAP_OWNS(ptr)) {
+        return map_realloc(ptr, size);
+    }
+
     /* 1. resize a free block is meaningless;
      * 2. if we want to resize a block that is smaller than MIN_BLK_SIZE, that means we points to a wrong block;
-     * 3. if the block size if no aligned, something wrong;
-     * 4. if the header is not same with the footer, something wrong.
+     * 3. if the block size if no aligned, something wrong.
      * */
-    if ((hdrp = RB_HDRP(ptr)) == NULL || (ftrp = RB_FTRP(ptr)) == NULL) {
+    if ((hdrp = RB_HDRP(ptr)) == NULL) {
 #ifdef DEBUG
-        printf("[DEBUG] in implicit_mm_realloc(): illegal header or footer\n");
+        printf("[DEBUG] in implicit_realloc(): illegal header\n");
 #endif
         return NULL;
     }
 
     bsize = RB_SIZE(ptr), alloc = RB_ALLOC(ptr);        /* current block size and its alloc state */
-    if (alloc == BLK_FREE || bsize <= MIN_BLK_SIZE || bsize % ALIGNMENT != 0 || GET(hdrp) != GET(ftrp)) {
+    if (alloc == BLK_FREE || bsize < MIN_BLK_SIZE || bsize % ALIGNMENT != 0) {
 #ifdef DEBUG
-        printf("[DEBUG] in implicit_mm_realloc(): illegal realloc: %p, %ld, %d, %ld, %ld, 0x%x, 0x%x\n",
-            ptr, size, alloc, bsize, bsize % ALIGNMENT, GET(hdrp), GET(ftrp));
+        printf("[DEBUG] in implicit_realloc(): illegal realloc: %p, %ld, %d, %ld, %ld, 0x%zx\n",
+            ptr, size, alloc, bsize, bsize % ALIGNMENT, (size_t) GET(hdrp));
 #endif
         return NULL;
     }
 
     /* legal block indeed, try to resize */
-    nsize = ALIGN(size) + RB_HDR_SIZE + RB_FTR_SIZE;        /* new size of the realloc block */
+    nsize = RB_NEED_SIZE(size);                             /* new size of the realloc block */
+    gsize = RB_GROWN(ptr) ? GROW_SIZE(bsize, nsize) : nsize;  /* with headroom if it grows again */
 
     /* same size with the origin block, do nothing */
     if (nsize == bsize) {
 #ifdef DEBUG
-        printf("[DEBUG] in implicit_mm_realloc(): same size, return\n");
+        printf("[DEBUG] in implicit_realloc(): same size, return\n");
 #endif
         p = ptr;
         goto realloc;
@@ -489,13 +727,19 @@ void *implicit_mm_realloc(void *ptr, size_t size) {
 
     /* smaller than the origin block, see if we must split it */
     if (nsize < bsize) {
+        /* still within the headroom of a grown block */
+        if (RB_GROWN(ptr) && GROW_KEEPS(bsize, nsize)) {
+            p = ptr;
+            goto realloc;
+        }
         rsize = bsize - nsize;
 
         /* need to split */
         if (rsize >= MIN_BLK_SIZE) {
             SET_RB(ptr, nsize, BLK_ALLOC);
             splitp = NEXT_BLKP(ptr);
-            SET_RB(splitp, rsize, BLK_FREE);
+            SET_RB2(splitp, rsize, BLK_ALLOC, BLK_FREE);
+            coalesce(splitp);
         }
         p = ptr;
         goto realloc;
@@ -513,97 +757,546 @@ void *implicit_mm_realloc(void *ptr, size_t size) {
         fsize = NEXT_BLK_SIZE(ptr);     /* block size that we can use of the next block */
 
         if (nsize <= bsize + fsize) {
-            /* enough size */
+            /* enough size, take the headroom too if it is there */
+            nsize = bsize + fsize < gsize ? bsize + fsize : gsize;
+            list_del(NEXT_BLKP(ptr));
             fsize -= (nsize - bsize);
             SET_RB(ptr, nsize, BLK_ALLOC);
             if (fsize >= MIN_BLK_SIZE) {
-                SET_RB(NEXT_BLKP(ptr), fsize, BLK_FREE);
+                SET_RB2(NEXT_BLKP(ptr), fsize, BLK_ALLOC, BLK_FREE);
+                list_insert(NEXT_BLKP(ptr));
+            } else {
+                SET_PREV_ALLOC(NEXT_BLKP(ptr), BLK_ALLOC);
             }
+            SET_GROWN(ptr);
             p = ptr;
             goto realloc;
-        } else if (EB(NEXT_BLKP(ptr))) {
+        } else if (EB(NEXT_BLKP(NEXT_BLKP(ptr)))) {
             /* not enough, but the next block is the tail */
-            fsize = nsize - bsize - fsize;
-            extend_heap(fsize);
+            if (extend_heap(nsize - bsize - fsize) == NULL) {
+                return NULL;
+            }
+            list_del(NEXT_BLKP(ptr));
             SET_RB(ptr, nsize, BLK_ALLOC);
+            SET_GROWN(ptr);
             p = ptr;
             goto realloc;
         }
     }
 
-    /* check previous */
-    prep = PREV_BLKP(ptr);
-    fsize = RB_SIZE(prep);
-    if ((RB_ALLOC(prep) == BLK_FREE) && (nsize <= bsize + fsize)) {
-        fsize -= (nsize - bsize);
-        memcpy(prep, ptr, RB_AVL_SIZE(ptr));
-        SET_RB(prep, nsize, BLK_ALLOC);
-        if (fsize >= MIN_BLK_SIZE) {
-            SET_RB(NEXT_BLKP(prep), fsize, BLK_FREE);
+    /* the tail block, just extend the heap, rather than moving it */
+    if (EB(NEXT_BLKP(ptr))) {
+        if (extend_heap(nsize - bsize) == NULL) {
+            return NULL;
         }
-        p = prep;
+        SET_RB(ptr, nsize, BLK_ALLOC);
+        SET_GROWN(ptr);
+        p = ptr;
         goto realloc;
     }
 
+    /* check previous, whose footer is there only if it is free */
+    if (PREV_BLK_ALLOC(ptr) == BLK_FREE) {
+        prep = PREV_BLKP(ptr);
+        fsize = RB_SIZE(prep);
+        if (nsize <= bsize + fsize) {
+            nsize = bsize + fsize < gsize ? bsize + fsize : gsize;
+            list_del(prep);
+            fsize -= (nsize - bsize);
+            memmove(prep, ptr, RB_AVL_SIZE(ptr));
+            SET_RB(prep, nsize, BLK_ALLOC);
+            if (fsize >= MIN_BLK_SIZE) {
+                SET_RB2(NEXT_BLKP(prep), fsize, BLK_ALLOC, BLK_FREE);
+                coalesce(NEXT_BLKP(prep));
+            } else {
+                SET_PREV_ALLOC(NEXT_BLKP(prep), BLK_ALLOC);
+            }
+            SET_GROWN(prep);
+            p = prep;
+            goto realloc;
+        }
+    }
+
     // TODO:
     /* there is a case that, the prev and the next block
      * all do not have enough room to realloc,
      * but the sum of them could fill the hole */
 
     /* we have no free block to reuse
-     * try to extend the heap
-     * 1. alloc new memory
-     *    if ptr points to the tail block, then we can just alloc a smaller block
-     *    than the whole size
-     *    if ptr is not, we have to alloc one with full size
-     * 2. copy if needed
-     * 3. free old if needed
+     * 1. alloc new memory with full size
+     * 2. copy
+     * 3. free old
      * */
-    if (ptr == TAIL_BLK()) {
-        /* tail block */
-        if ((p = extend_heap(nsize - bsize)) == (void *) -1) {
-            return NULL;
-        }
-    } else {
-        /* need a totally new block */
-        if ((p = do_malloc(ALIGN(size))) == NULL) {
-            return NULL;
-        }
-        memcpy(p, ptr, RB_AVL_SIZE(ptr));
-        implicit_mm_free(ptr);
+    /* need a totally new block, with the headroom, which is mapped if large */
+    size = gsize - RB_HDR_SIZE;
+    if ((p = MAP_HOLDS(size) ? map_alloc(size) : do_malloc(size)) == NULL) {
+        return NULL;
+    }
+    memcpy(p, ptr, RB_AVL_SIZE(ptr));
+    implicit_free(ptr);
+    if (!MAP_OWNS(p)) {
+        SET_GROWN(p);
     }
 
-    SET_RB(p, nsize, BLK_ALLOC);
     goto realloc;
 
     realloc:
 #ifdef  DUMP_HEAP
-    dump("realloc", size, p);
+    implicit_dump("realloc", size, p);
 #endif
-#ifdef USE_NEXT_FIT
+#ifdef NEXT_FIT_ON_HEAP
     heap_curp = p;
 #endif
     return p;
 }
 
+/**
+ * Bytes the block ptr can hold, which may be more than asked for
+ * @param ptr
+ * @return
+ */
+static size_t implicit_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    return MAP_OWNS(ptr) ? MAP_AVAL_SIZE(ptr) : RB_AVL_SIZE(ptr);
+}
+
+/**
+ * Grow the block ptr where it is, to hold min bytes at least and max bytes at most
+ * @param ptr
+ * @param min
+ * @param max
+ * @return the usable size of the block, or 0 if it cannot hold min bytes without moving
+ */
+static size_t implicit_try_expand(void *ptr, size_t min, size_t max) {
+    // 1. a block that holds min bytes already is left as it is;
+    // 2. absorb the free next block, up to max, and split the rest off if it is big enough;
+    // 3. if the block, or the free next block, is the tail of the heap, extend the heap up to min.
+    // never the prev block, which would move the payload, nor a mapped block, which mem_remap() may move.
+    size_t bsize, fsize, nsize;
+
+    if (ptr == NULL || min > mem_maxheap()) {
+        return 0;
+    }
+    if (max > mem_maxheap()) {
+        max = mem_maxheap();
+    }
+    if (implicit_usable_size(ptr) >= min) {
+        return implicit_usable_size(ptr);
+    }
+    if (MAP_OWNS(ptr)) {
+        return 0;
+    }
+
+    bsize = RB_SIZE(ptr);
+    nsize = RB_NEED_SIZE(min);
+    fsize = NEXT_BLK_ALLOC(ptr) == BLK_FREE ? NEXT_BLK_SIZE(ptr) : 0;
+
+    if (bsize + fsize >= nsize) {
+        if (max > min) {
+            nsize = RB_NEED_SIZE(max) < bsize + fsize ? RB_NEED_SIZE(max) : bsize + fsize;
+        }
+        list_del(NEXT_BLKP(ptr));
+        if (bsize + fsize - nsize >= MIN_BLK_SIZE) {
+            SET_RB(ptr, nsize, BLK_ALLOC);
+            SET_RB2(NEXT_BLKP(ptr), bsize + fsize - nsize, BLK_ALLOC, BLK_FREE);
+            list_insert(NEXT_BLKP(ptr));
+        } else {
+            SET_RB(ptr, bsize + fsize, BLK_ALLOC);
+            SET_PREV_ALLOC(NEXT_BLKP(ptr), BLK_ALLOC);
+        }
+    } else if (EB(fsize != 0 ? NEXT_BLKP(NEXT_BLKP(ptr)) : NEXT_BLKP(ptr))) {
+        if (extend_heap(nsize - bsize - fsize) == NULL) {
+            return 0;
+        }
+        if (fsize != 0) {
+            list_del(NEXT_BLKP(ptr));
+        }
+        SET_RB(ptr, nsize, BLK_ALLOC);
+    } else {
+        return 0;
+    }
+
+#ifdef DUMP_HEAP
+    implicit_dump("try expand", min, ptr);
+#endif
+    return RB_AVL_SIZE(ptr);
+}
+
+/**
+ * Allocate size bytes at a multiple of alignment
+ * @param alignment: a power of 2
+ * @param size
+ * @return
+ */
+static void *implicit_memalign(size_t alignment, size_t size) {
+    // 1. take a block with room for size bytes at any alignment, after a leading fragment;
+    // 2. split the leading fragment off as a free block, so it is not wasted;
+    // 3. split the tail off as a free block, if it is big enough.
+    // aligned blocks always come from the heap, as a mapped one must start right after its header.
+    void *p, *q, *splitp;
+    size_t asize, lsize, nsize, rsize;
+
+    if (alignment <= ALIGNMENT) {
+        return implicit_malloc(size);
+    }
+    if (size == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+
+    asize = size + alignment + MIN_BLK_SIZE;
+    if ((p = find_fit(asize)) == NULL && (p = do_malloc(asize)) == NULL) {
+        return NULL;
+    }
+
+    /* a leading fragment must be big enough to be a block */
+    q = (void *) (((size_t) p + alignment - 1) & ~(alignment - 1));
+    while (q != p && q - p < MIN_BLK_SIZE) {
+        q += alignment;
+    }
+
+    lsize = q - p;
+    if (lsize > 0) {
+        SET_RB2(q, RB_SIZE(p) - lsize, BLK_FREE, BLK_ALLOC);
+        SET_RB(p, lsize, BLK_FREE);
+        coalesce(p);
+    }
+
+    nsize = RB_NEED_SIZE(size);
+    if ((rsize = RB_SIZE(q) - nsize) >= MIN_BLK_SIZE) {
+        SET_RB(q, nsize, BLK_ALLOC);
+        splitp = NEXT_BLKP(q);
+        SET_RB2(splitp, rsize, BLK_ALLOC, BLK_FREE);
+        coalesce(splitp);
+    }
+
+#ifdef DUMP_HEAP
+    implicit_dump("memalign", size, q);
+#endif
+#ifdef NEXT_FIT_ON_HEAP
+    heap_curp = q;
+#endif
+    return q;
+}
+
+
+/******************************************
+ * mapped blocks
+ * NOTE: callers must hold the heap_lock
+ ******************************************/
+
+/**
+ * Map a region of its own for a large block
+ * @param size
+ * @return the payload, or NULL if failed
+ */
+static void *map_alloc(size_t size) {
+    void *p;
+    size_t len;
+
+    len = MAP_NEED_LEN(size);
+    if ((p = mem_map(len)) == (void *) -1) {
+        return NULL;
+    }
+    p += MAP_HDR_SIZE;
+    MAP_LEN(p) = len;
+    return p;
+}
+
+/**
+ * Give the whole region of a mapped block back
+ * @param ptr
+ */
+static void map_free(void *ptr) {
+    mem_unmap(ptr - MAP_HDR_SIZE);
+}
+
+/**
+ * Resize a mapped block: remap it while it is still large, or move it into the heap
+ * @param ptr
+ * @param size
+ * @return
+ */
+static void *map_realloc(void *ptr, size_t size) {
+    void *p;
+    size_t len;
+
+    if (MAP_HOLDS(size)) {
+        if ((len = MAP_NEED_LEN(size)) == MAP_LEN(ptr)) {
+            return ptr;
+        }
+        if ((p = mem_remap(ptr - MAP_HDR_SIZE, len)) == (void *) -1) {
+            return NULL;
+        }
+        p += MAP_HDR_SIZE;
+        MAP_LEN(p) = len;
+        return p;
+    }
+
+    if ((p = implicit_malloc(size)) == NULL) {
+        return NULL;
+    }
+    memcpy(p, ptr, size);
+    map_free(ptr);
+    return p;
+}
+
+/******************************************
+ * allocator open APIs
+ ******************************************/
+
+/**
+ * Pick the fit strategy, before implicit_mm_init()
+ * @param fit one of IMPLICIT_*_FIT
+ */
+void implicit_mm_set_fit(int fit) {
+    MM_LOCK(&heap_lock);
+    heap_fit = fit;
+    MM_UNLOCK(&heap_lock);
+}
+
+/**
+ *
+ * @return
+ */
+int implicit_mm_init(void) {
+    int ret;
+
+    MM_LOCK(&heap_lock);
+    ret = implicit_init();
+    MM_UNLOCK(&heap_lock);
+
+    return ret;
+}
+
+/**
+ *
+ * @param size
+ * @return
+ */
+void *implicit_mm_malloc(size_t size) {
+    void *p;
+
+    MM_LOCK(&heap_lock);
+    p = implicit_malloc(size);
+    MM_UNLOCK(&heap_lock);
+
+    return p;
+}
+
+/**
+ *
+ * @param alignment
+ * @param size
+ * @return
+ */
+void *implicit_mm_memalign(size_t alignment, size_t size) {
+    void *p;
+
+    MM_LOCK(&heap_lock);
+    p = implicit_memalign(alignment, size);
+    MM_UNLOCK(&heap_lock);
+
+    return p;
+}
+
+/**
+ *
+ * @param ptr
+ */
+void implicit_mm_free(void *ptr) {
+    MM_LOCK(&heap_lock);
+    implicit_free(ptr);
+    MM_UNLOCK(&heap_lock);
+}
+
+/**
+ * Free ptr, whose size, as last given to malloc or realloc, the caller knows.
+ * a block is coalesced through its own header anyway, so the size is only checked, in DEBUG
+ * @param ptr
+ * @param size
+ */
+void implicit_mm_free_sized(void *ptr, size_t size) {
+#ifdef DEBUG
+    size_t aval;
+
+    aval = MAP_OWNS(ptr) ? MAP_AVAL_SIZE(ptr) : RB_AVL_SIZE(ptr);
+    if (size > aval) {
+        fprintf(stderr, "freeing %zu bytes of a %zu-byte block! %p\n", size, aval, ptr);
+    }
+#endif
+    implicit_mm_free(ptr);
+}
+
+/**
+ *
+ * @param ptr
+ * @param size
+ * @return
+ */
+void *implicit_mm_realloc(void *ptr, size_t size) {
+    void *p;
+
+    MM_LOCK(&heap_lock);
+    p = implicit_realloc(ptr, size);
+    MM_UNLOCK(&heap_lock);
+
+    return p;
+}
+
+/**
+ *
+ * @param ptr
+ * @return
+ */
+size_t implicit_mm_usable_size(void *ptr) {
+    size_t size;
+
+    MM_LOCK(&heap_lock);
+    size = implicit_usable_size(ptr);
+    MM_UNLOCK(&heap_lock);
+
+    return size;
+}
+
+/**
+ *
+ * @param ptr
+ * @param min
+ * @param max
+ * @return
+ */
+size_t implicit_mm_try_expand(void *ptr, size_t min, size_t max) {
+    size_t size;
+
+    MM_LOCK(&heap_lock);
+    size = implicit_try_expand(ptr, min, max);
+    MM_UNLOCK(&heap_lock);
+
+    return size;
+}
+
+/******************************************
+ * batches
+ ******************************************/
+
+/**
+ * Allocate n blocks of size bytes at once, carved back to back from a single fit. without one,
+ * the free blocks that fit a single block are taken first, as n mallocs would, and the rest is
+ * carved from the free tail block and a single extension of the heap, see do_malloc().
+ * large requests go one by one
+ * @param size
+ * @param n
+ * @param out: the blocks
+ * @return the number of blocks allocated, n unless out of memory
+ */
+int implicit_mm_malloc_batch(size_t size, int n, void **out) {
+    void *p;
+    size_t bsize, rsize;
+    int i, j;
+
+    i = 0;
+    bsize = RB_NEED_SIZE(size);
+    if (n > 1 && size > 0 && !MAP_HOLDS(size) && (size_t) n * bsize <= mem_maxheap()) {
+        MM_LOCK(&heap_lock);
+        if ((p = find_fit(n * bsize - RB_HDR_SIZE)) == NULL) {
+            /* once no free block fits, every other malloc would extend the heap too */
+            while (i < n && (p = find_fit(size)) != NULL) {
+                out[i++] = p;
+            }
+            p = i < n ? do_malloc((n - i) * bsize - RB_HDR_SIZE) : NULL;
+        }
+        if (p != NULL) {
+            /* a fit too small to split goes with the last block */
+            rsize = RB_SIZE(p) - (n - i) * bsize;
+            SET_RB(p, i == n - 1 ? bsize + rsize : bsize, BLK_ALLOC);
+            for (j = i; j < n; j++) {
+                if (j > i) {
+                    SET_RB2(p, j == n - 1 ? bsize + rsize : bsize, BLK_ALLOC, BLK_ALLOC);
+                }
+                out[j] = p;
+                p += bsize;
+            }
+            i = n;
+        }
+        MM_UNLOCK(&heap_lock);
+    }
+
+    for (; i < n && (out[i] = implicit_mm_malloc(size)) != NULL; i++);
+    return i;
+}
+
+/**
+ * Order of two block pointers, for qsort()
+ * @param a
+ * @param b
+ * @return
+ */
+static int ptr_cmp(const void *a, const void *b) {
+    char *p = *(char **) a, *q = *(char **) b;
+
+    return p < q ? -1 : p > q;
+}
+
+/**
+ * Free n blocks at once. they are sorted by address, so that blocks right after each other
+ * make a single free block, which is coalesced only once
+ * @param ptrs: the blocks, sorted in place
+ * @param n
+ */
+void implicit_mm_free_batch(void **ptrs, int n) {
+    void *p, *endp;
+    size_t size;
+    int i, j;
+
+    qsort(ptrs, n, sizeof(void *), ptr_cmp);
+
+    MM_LOCK(&heap_lock);
+    for (i = 0; i < n; i = j) {
+        j = i + 1;
+        if ((p = ptrs[i]) == NULL) {
+            continue;
+        }
+        if (MAP_OWNS(p)) {
+            map_free(p);
+            continue;
+        }
+
+        /* the run of blocks that starts at p */
+        size = RB_SIZE(p);
+        for (endp = p + size; j < n && ptrs[j] == endp; j++) {
+            size += RB_SIZE(endp);
+            endp += RB_SIZE(endp);
+        }
+
+        SET_RB(p, size, BLK_FREE);
+        coalesce(p);
+    }
+    MM_UNLOCK(&heap_lock);
+}
 
 /******************************************
  * heap dumper
  ******************************************/
-void dump(char *msg, size_t size, void *p) {
+void implicit_dump(char *msg, size_t size, void *p) {
     void *s;
 
     s = heap_listp;
 
     printf("\n");
-    printf("after %s %d(0x%x) memory at %p:\n", msg, (int) size, (int) size, p);
+    printf("after %s %zu(0x%zx) memory at %p:\n", msg, size, size, p);
     printf("==========================================================================================\n");
     while (s != NULL && !EB(s)) {
         printf("%s\t", RB_ALLOC(s) ? "alloc" : "free");
-        printf("%8d(%8x)\t", RB_SIZE(s), RB_SIZE(s));
+        printf("%8zu(%8zx)\t", (size_t) RB_SIZE(s), (size_t) RB_SIZE(s));
         printf("%p --- ", s);
         printf("%p\t", s + RB_SIZE(s) - 1);
-        printf("%8x\t%8x\n", GET(RB_HDRP(s)), GET(RB_FTRP(s)));
+        if (RB_ALLOC(s)) {
+            printf("%8zx\n", (size_t) GET(RB_HDRP(s)));
+        } else {
+            printf("%8zx\t%8zx\n", (size_t) GET(RB_HDRP(s)), (size_t) GET(RB_FTRP(s)));
+        }
 
         s = NEXT_BLKP(s);
     }
@@ -7,6 +7,19 @@ extern void *mm_realloc(void *ptr, size_t size);
 
 int implicit_mm_init(void);
 void *implicit_mm_malloc(size_t size);
+void *implicit_mm_memalign(size_t alignment, size_t size);
 void implicit_mm_free(void *ptr);
+void implicit_mm_free_sized(void *ptr, size_t size);
 void *implicit_mm_realloc(void *ptr, size_t size);
+size_t implicit_mm_usable_size(void *ptr);
+size_t implicit_mm_try_expand(void *ptr, size_t min, size_t max);
+int implicit_mm_malloc_batch(size_t size, int n, void **out);
+void implicit_mm_free_batch(void **ptrs, int n);
+
+/* fit strategies, see implicit_mm_set_fit() */
+#define IMPLICIT_FIRST_FIT  0
+#define IMPLICIT_NEXT_FIT   1
+#define IMPLICIT_BEST_FIT   2
+
+void implicit_mm_set_fit(int fit);
 
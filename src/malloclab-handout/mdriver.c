@@ -30,6 +30,9 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Max number of ops replayed as one batch, see replay_malloc() */
+#define BATCH_MAX     64
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -51,6 +54,8 @@ typedef struct {
     } type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int align;                        /* alignment of an aligned alloc, 0 for malloc */
+    int zero;                         /* calloc, the block must come back zeroed */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -83,6 +88,9 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak;     /* largest footprint in bytes, heap plus mapped (always 0 for libc) */
+    size_t heap;     /* footprint in bytes at the end of the trace */
+    double maxop;    /* worst time of a single op in secs (always 0 for libc) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -94,6 +102,17 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* Batch replay (-b): runs of ops go to mm_malloc_batch/mm_free_batch */
+static int batch_replay = 0;
+static char *batch_ptrs[BATCH_MAX];  /* blocks of the current batch */
+static int batch_lo, batch_hi;       /* ops of the current batch, [lo, hi) */
+
+/* Sized free (-s): frees go to mm_free_sized with the size of the block */
+static int sized_free = 0;
+
+/* Expand realloc (-x): a growing realloc tries mm_try_expand first */
+static int expand_realloc = 0;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -127,6 +146,8 @@ static int eval_libc_valid(trace_t *trace, int tracenum);
 
 static void eval_libc_speed(void *ptr);
 
+static char *libc_malloc(trace_t *trace, int i);
+
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
@@ -135,9 +156,27 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 
 static void eval_mm_speed(void *ptr);
 
+static char *replay_malloc(trace_t *trace, int i);
+
+static void replay_free(trace_t *trace, int i);
+
+static char *replay_realloc(trace_t *trace, int i);
+
+static double eval_mm_maxop(trace_t *trace);
+
+static stats_t *eval_mm(char **tracefiles, int num_tracefiles);
+
+static double perf_index(stats_t *stats, int n, double *p1, double *p2);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
 
+static void printcompare(int n, stats_t **stats, int *errs);
+
+static void printpages(void);
+
+static size_t parse_size(char *s);
+
 static void usage(void);
 
 static void unix_error(char *msg);
@@ -152,12 +191,11 @@ static void app_error(char *msg);
  * Main routine
  **************/
 int main(int argc, char **argv) {
-    int i;
+    int i, b;
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a trace file for check */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */
@@ -165,9 +203,12 @@ int main(int argc, char **argv) {
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int run_all = 0;     /* If set, run every mm allocator side by side (-m all) */
+    stats_t **all_stats; /* mm stats of every allocator, for -m all */
+    int *all_errors;     /* errors of every allocator, for -m all */
 
     /* temporaries used to compute the performance index */
-    double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
+    double p1, p2, perfindex;
     int numcorrect;
 
     ftimer_test_exclude clean = (void (*)(void*))(&clean_up);     /* clean trace each time */
@@ -175,7 +216,7 @@ int main(int argc, char **argv) {
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:m:M:hvVgalbsx")) != EOF) {
         switch (c) {
             case 'g': /* Generate summary info for the autograder */
                 autograder = 1;
@@ -201,6 +242,32 @@ int main(int argc, char **argv) {
             case 'l': /* Run libc malloc */
                 run_libc = 1;
                 break;
+            case 'b': /* Replay runs of same-size allocs, and of frees, in batches */
+                batch_replay = 1;
+                break;
+            case 's': /* Free with mm_free_sized */
+                sized_free = 1;
+                break;
+            case 'x': /* Grow with mm_try_expand before mm_realloc */
+                expand_realloc = 1;
+                break;
+            case 'm': /* Run one mm allocator by name, or all of them */
+                if (!strcmp(optarg, "all"))
+                    run_all = 1;
+                else if (mm_select(optarg) < 0) {
+                    fprintf(stderr, "ERROR: no allocator called %s\n", optarg);
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'M': /* Size of the simulated heap, before mem_init() maps it */
+                if (parse_size(optarg) == 0) {
+                    fprintf(stderr, "ERROR: bad heap size %s\n", optarg);
+                    usage();
+                    exit(1);
+                }
+                mem_set_maxheap(parse_size(optarg));
+                break;
             case 'v': /* Print per-trace performance breakdown */
                 verbose = 1;
                 break;
@@ -294,74 +361,53 @@ int main(int argc, char **argv) {
     if (verbose > 1)
         printf("\nTesting mm malloc\n");
 
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *) calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-        unix_error("mm_stats calloc in main failed");
-
     /* Initialize the simulated memory system in memlib.c */
     mem_init();
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i = 0; i < num_tracefiles; i++) {
-        trace = read_trace(tracedir, tracefiles[i]);
-        mm_stats[i].ops = trace->num_ops;
-        if (verbose > 1)
-            printf("Checking mm_malloc for correctness:\n");
-        mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-        if (mm_stats[i].valid) {
+    /* Evaluate every allocator linked in, and compare them */
+    if (run_all) {
+        for (b = 0; mm_backends[b].name != NULL; b++);
+        all_stats = (stats_t **) calloc(b, sizeof(stats_t *));
+        all_errors = (int *) calloc(b, sizeof(int));
+        if (all_stats == NULL || all_errors == NULL)
+            unix_error("all_stats calloc in main failed");
+
+        for (b = 0; mm_backends[b].name != NULL; b++) {
+            mm_backend = &mm_backends[b];
+            errors = 0;
             if (verbose > 1)
-                printf("efficiency:\n");
-            clean(trace);
-            mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-            speed_params.ranges = ranges;
-            speed_params.trace = trace;
-            if (verbose > 1)
-                printf("and performance.\n");
-            clean(trace);
-            mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params, clean, trace);
+                printf("\nTesting %s\n", mm_backend->name);
+            all_stats[b] = eval_mm(tracefiles, num_tracefiles);
+            all_errors[b] = errors;
         }
-        free_trace(trace);
+
+        printf("\nResults for every mm allocator (util, Kops):\n");
+        printcompare(num_tracefiles, all_stats, all_errors);
+        printpages();
+        exit(0);
     }
 
+    mm_stats = eval_mm(tracefiles, num_tracefiles);
+
     /* Display the mm results in a compact table */
     if (verbose) {
-        printf("\nResults for mm malloc:\n");
+        printf("\nResults for mm malloc (%s):\n", mm_backend->name);
         printresults(num_tracefiles, mm_stats);
+        printpages();
         printf("\n");
     }
 
     /* 
-     * Accumulate the aggregate statistics for the student's mm package 
+     * Compute and print the performance index 
      */
-    secs = 0;
-    ops = 0;
-    util = 0;
     numcorrect = 0;
     for (i = 0; i < num_tracefiles; i++) {
-        secs += mm_stats[i].secs;
-        ops += mm_stats[i].ops;
-        util += mm_stats[i].util;
         if (mm_stats[i].valid)
             numcorrect++;
     }
-    avg_mm_util = util / num_tracefiles;
 
-    /* 
-     * Compute and print the performance index 
-     */
     if (errors == 0) {
-        avg_mm_throughput = ops / secs;
-
-        p1 = UTIL_WEIGHT * avg_mm_util;
-        if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-            p2 = (double) (1.0 - UTIL_WEIGHT);
-        } else {
-            p2 = ((double) (1.0 - UTIL_WEIGHT)) *
-                 (avg_mm_throughput / AVG_LIBC_THRUPUT);
-        }
-
-        perfindex = (p1 + p2) * 100.0;
+        perfindex = perf_index(mm_stats, num_tracefiles, &p1, &p2);
         printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
                p1 * 100,
                p2 * 100,
@@ -409,9 +455,10 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *) mem_heap_lo()) || (lo > (char *) mem_heap_hi()) ||
-        (hi < (char *) mem_heap_lo()) || (hi > (char *) mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or of a mapped region */
+    if (((lo < (char *) mem_heap_lo()) || (lo > (char *) mem_heap_hi()) ||
+         (hi < (char *) mem_heap_lo()) || (hi > (char *) mem_heap_hi())) &&
+        !mem_is_mapped(lo, hi)) {
         sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
                 lo, hi, mem_heap_lo(), mem_heap_hi());
         malloc_error(tracenum, opnum, msg);
@@ -486,7 +533,7 @@ static trace_t *read_trace(char *tracedir, char *filename) {
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, align;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -530,10 +577,22 @@ static trace_t *read_trace(char *tracedir, char *filename) {
     while (fscanf(tracefile, "%s", type) != EOF) {
         switch (type[0]) {
             case 'a':
+            case 'c':
                 fscanf(tracefile, "%u %u", &index, &size);
                 trace->ops[op_index].type = ALLOC;
                 trace->ops[op_index].index = index;
                 trace->ops[op_index].size = size;
+                trace->ops[op_index].align = 0;
+                trace->ops[op_index].zero = (type[0] == 'c');
+                max_index = (index > max_index) ? index : max_index;
+                break;
+            case 'm':
+                fscanf(tracefile, "%u %u %u", &index, &size, &align);
+                trace->ops[op_index].type = ALLOC;
+                trace->ops[op_index].index = index;
+                trace->ops[op_index].size = size;
+                trace->ops[op_index].align = align;
+                trace->ops[op_index].zero = 0;
                 max_index = (index > max_index) ? index : max_index;
                 break;
             case 'r':
@@ -609,6 +668,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
         malloc_error(tracenum, 0, "mm_init failed.");
         return 0;
     }
+    batch_lo = batch_hi = 0;
 
     /* Interpret each operation in the trace in order */
     for (i = 0; i < trace->num_ops; i++) {
@@ -623,7 +683,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
             case ALLOC: /* mm_malloc */
 
                 /* Call the student's malloc */
-                if ((p = mm_malloc(size)) == NULL) {
+                if ((p = replay_malloc(trace, i)) == NULL) {
                     malloc_error(tracenum, i, "mm_malloc failed.");
                     return 0;
                 }
@@ -636,6 +696,24 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
                 if (add_range(ranges, p, size, tracenum, i) == 0)
                     return 0;
 
+                /* An aligned alloc must honor its alignment too */
+                if (trace->ops[i].align && (size_t) p % trace->ops[i].align != 0) {
+                    sprintf(msg, "Payload address (%p) not aligned to %d bytes",
+                            p, trace->ops[i].align);
+                    malloc_error(tracenum, i, msg);
+                    return 0;
+                }
+
+                /* A calloc block must be all zeros */
+                if (trace->ops[i].zero) {
+                    for (j = 0; j < size; j++) {
+                        if (p[j] != 0) {
+                            malloc_error(tracenum, i, "mm_calloc did not zero the block");
+                            return 0;
+                        }
+                    }
+                }
+
                 /* ADDED: cgw
                  * fill range with low byte of index.  This will be used later
                  * if we realloc the block and wish to make sure that the old
@@ -652,7 +730,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
 
                 /* Call the student's realloc */
                 oldp = trace->blocks[index];
-                if ((newp = mm_realloc(oldp, size)) == NULL) {
+                if ((newp = replay_realloc(trace, i)) == NULL) {
                     malloc_error(tracenum, i, "mm_realloc failed.");
                     return 0;
                 }
@@ -690,7 +768,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
                 /* Remove region from list and call student's free function */
                 p = trace->blocks[index];
                 remove_range(ranges, p);
-                mm_free(p);
+                replay_free(trace, i);
                 break;
 
             default:
@@ -707,25 +785,27 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
- *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
+ *   Utilization is the ratio hwm/footprint, where footprint is the 
+ *   largest size of the heap plus the mapped regions in bytes while
+ *   running the student's malloc package on the trace. mem_sbrk() lets
+ *   the package give memory back by decrementing the brk pointer, and
+ *   mem_unmap() too, so the final footprint is not the high water mark,
+ *   mem_peaksize() is.
+ *
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
     int i;
     int index;
     int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    size_t max_total_size = 0;
+    size_t total_size = 0;
     char *p;
-    char *newp, *oldp;
+    char *newp;
 
     /* initialize the heap and the mm malloc package */
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_util");
+    batch_lo = batch_hi = 0;
 
     for (i = 0; i < trace->num_ops; i++) {
         switch (trace->ops[i].type) {
@@ -734,7 +814,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
 
-                if ((p = mm_malloc(size)) == NULL)
+                if ((p = replay_malloc(trace, i)) == NULL)
                     app_error("mm_malloc failed in eval_mm_util");
 
                 /* Remember region and size */
@@ -755,8 +835,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
                 newsize = trace->ops[i].size;
                 oldsize = trace->block_sizes[index];
 
-                oldp = trace->blocks[index];
-                if ((newp = mm_realloc(oldp, newsize)) == NULL)
+                if ((newp = replay_realloc(trace, i)) == NULL)
                     realloc_error(tracenum, i, "mm_realloc failed in eval_mm_util");
 
                 /* Remember region and size */
@@ -775,9 +854,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
             case FREE: /* mm_free */
                 index = trace->ops[i].index;
                 size = trace->block_sizes[index];
-                p = trace->blocks[index];
-
-                mm_free(p);
+                replay_free(trace, i);
 
                 /* Keep track of current total size
                  * of all allocated blocks */
@@ -791,22 +868,99 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges) {
         }
     }
 
-    return ((double) max_total_size / (double) mem_heapsize());
+    return ((double) max_total_size / (double) mem_peaksize());
 }
 
 
+/*
+ * eval_mm - Evaluate the current mm package on every trace, for
+ *    correctness, space utilization, and speed, and return the stats
+ *    with one stats_t struct per tracefile.
+ */
+static stats_t *eval_mm(char **tracefiles, int num_tracefiles) {
+    int i;
+    trace_t *trace;
+    range_t *ranges = NULL;
+    stats_t *stats;
+    speed_t speed_params;
+    ftimer_test_exclude clean = (void (*)(void*))(&clean_up);
+
+    stats = (stats_t *) calloc(num_tracefiles, sizeof(stats_t));
+    if (stats == NULL)
+        unix_error("mm_stats calloc in eval_mm failed");
+
+    /* Evaluate student's mm malloc package using the K-best scheme */
+    for (i = 0; i < num_tracefiles; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        stats[i].ops = trace->num_ops;
+        if (verbose > 1)
+            printf("Checking mm_malloc for correctness:\n");
+        stats[i].valid = eval_mm_valid(trace, i, &ranges);
+        if (stats[i].valid) {
+            if (verbose > 1)
+                printf("efficiency:\n");
+            clean(trace);
+            stats[i].util = eval_mm_util(trace, i, &ranges);
+            stats[i].peak = mem_peaksize();
+            stats[i].heap = mem_heapsize() + mem_mapsize();
+            speed_params.ranges = ranges;
+            speed_params.trace = trace;
+            if (verbose > 1)
+                printf("and performance.\n");
+            clean(trace);
+            stats[i].secs = fsecs(eval_mm_speed, &speed_params, clean, trace);
+            clean(trace);
+            stats[i].maxop = eval_mm_maxop(trace);
+        }
+        free_trace(trace);
+    }
+    clear_ranges(&ranges);
+
+    return stats;
+}
+
+/*
+ * perf_index - The performance index of a mm package out of 100,
+ *    from its stats on n traces, split into its util part p1 and its
+ *    throughput part p2. Only meaningful if all the traces are valid.
+ */
+static double perf_index(stats_t *stats, int n, double *p1, double *p2) {
+    int i;
+    double secs = 0, ops = 0, util = 0;
+    double avg_mm_util, avg_mm_throughput;
+
+    for (i = 0; i < n; i++) {
+        secs += stats[i].secs;
+        ops += stats[i].ops;
+        util += stats[i].util;
+    }
+    avg_mm_util = util / n;
+    avg_mm_throughput = ops / secs;
+
+    *p1 = UTIL_WEIGHT * avg_mm_util;
+    if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+        *p2 = (double) (1.0 - UTIL_WEIGHT);
+    } else {
+        *p2 = ((double) (1.0 - UTIL_WEIGHT)) *
+              (avg_mm_throughput / AVG_LIBC_THRUPUT);
+    }
+
+    return (*p1 + *p2) * 100.0;
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr) {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
+    int i, index, newsize;
+    char *p, *newp;
     trace_t *trace = ((speed_t *) ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_speed");
+    batch_lo = batch_hi = 0;
 
     /* Interpret each trace request */
     for (i = 0; i < trace->num_ops; i++)
@@ -814,25 +968,23 @@ static void eval_mm_speed(void *ptr) {
 
             case ALLOC: /* mm_malloc */
                 index = trace->ops[i].index;
-                size = trace->ops[i].size;
-                if ((p = mm_malloc(size)) == NULL)
+                if ((p = replay_malloc(trace, i)) == NULL)
                     app_error("mm_malloc error in eval_mm_speed");
                 trace->blocks[index] = p;
+                trace->block_sizes[index] = trace->ops[i].size;
                 break;
 
             case REALLOC: /* mm_realloc */
                 index = trace->ops[i].index;
                 newsize = trace->ops[i].size;
-                oldp = trace->blocks[index];
-                if ((newp = mm_realloc(oldp, newsize)) == NULL)
+                if ((newp = replay_realloc(trace, i)) == NULL)
                     realloc_error(-1, i, "mm_realloc error in eval_mm_speed");
                 trace->blocks[index] = newp;
+                trace->block_sizes[index] = newsize;
                 break;
 
             case FREE: /* mm_free */
-                index = trace->ops[i].index;
-                block = trace->blocks[index];
-                mm_free(block);
+                replay_free(trace, i);
                 break;
 
             default:
@@ -840,6 +992,147 @@ static void eval_mm_speed(void *ptr) {
         }
 }
 
+/*
+ * batch_end - The end of the run of ops that can be replayed in one batch
+ *     with ops[i]: allocs of the same size, or frees, up to BATCH_MAX
+ */
+static int batch_end(trace_t *trace, int i) {
+    int j;
+
+    for (j = i + 1; j < trace->num_ops && j - i < BATCH_MAX; j++) {
+        if (trace->ops[j].type != trace->ops[i].type)
+            break;
+        if (trace->ops[i].type == ALLOC && (trace->ops[j].size != trace->ops[i].size ||
+                                            trace->ops[j].align != trace->ops[i].align ||
+                                            trace->ops[j].zero != trace->ops[i].zero))
+            break;
+    }
+    return j;
+}
+
+/*
+ * replay_malloc - Replay the ALLOC op ops[i]. With -b, the first alloc
+ *     of a run allocates the whole run with mm_malloc_batch, and the
+ *     others just take their block. Aligned allocs and callocs never
+ *     batch.
+ */
+static char *replay_malloc(trace_t *trace, int i) {
+    int n;
+
+    if (trace->ops[i].align)
+        return mm_memalign(trace->ops[i].align, trace->ops[i].size);
+    if (trace->ops[i].zero)
+        return mm_calloc(1, trace->ops[i].size);
+    if (!batch_replay)
+        return mm_malloc(trace->ops[i].size);
+
+    if (i < batch_lo || i >= batch_hi) {
+        n = mm_malloc_batch(trace->ops[i].size, batch_end(trace, i) - i, (void **) batch_ptrs);
+        if (n == 0)
+            return NULL;
+        batch_lo = i;
+        batch_hi = i + n;
+    }
+    return batch_ptrs[i - batch_lo];
+}
+
+/*
+ * replay_free - Replay the FREE op ops[i]. With -b, the first free
+ *     of a run frees the whole run with mm_free_batch, and the others
+ *     are done already. With -s, a single free passes the size of the
+ *     block, kept in block_sizes, to mm_free_sized.
+ */
+static void replay_free(trace_t *trace, int i) {
+    int j, index;
+
+    if (!batch_replay) {
+        index = trace->ops[i].index;
+        if (sized_free)
+            mm_free_sized(trace->blocks[index], trace->block_sizes[index]);
+        else
+            mm_free(trace->blocks[index]);
+        return;
+    }
+
+    if (i >= batch_lo && i < batch_hi)
+        return;
+
+    batch_lo = i;
+    batch_hi = batch_end(trace, i);
+    for (j = i; j < batch_hi; j++)
+        batch_ptrs[j - i] = trace->blocks[trace->ops[j].index];
+    mm_free_batch((void **) batch_ptrs, batch_hi - i);
+}
+
+/*
+ * replay_realloc - Replay the REALLOC op ops[i]. With -x, a block that
+ *     has to grow first tries mm_try_expand, which never moves it, and
+ *     goes to mm_realloc only if that fails.
+ */
+static char *replay_realloc(trace_t *trace, int i) {
+    char *oldp = trace->blocks[trace->ops[i].index];
+    size_t size = trace->ops[i].size;
+
+    if (expand_realloc && oldp != NULL && mm_usable_size(oldp) < size &&
+        mm_try_expand(oldp, size, size) >= size)
+        return oldp;
+    return mm_realloc(oldp, size);
+}
+
+/*
+ * eval_mm_maxop - Run the trace once more, timing every request on its
+ *    own, and return the worst of them in secs. Kept apart from
+ *    eval_mm_speed() so that the clock reads do not count against
+ *    the throughput.
+ */
+static double eval_mm_maxop(trace_t *trace) {
+    int i, index;
+    char *p;
+    struct timespec t0, t1;
+    double t, maxop = 0;
+
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_maxop");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        switch (trace->ops[i].type) {
+
+            case ALLOC: /* mm_malloc */
+                if (trace->ops[i].align)
+                    p = mm_memalign(trace->ops[i].align, trace->ops[i].size);
+                else if (trace->ops[i].zero)
+                    p = mm_calloc(1, trace->ops[i].size);
+                else
+                    p = mm_malloc(trace->ops[i].size);
+                break;
+
+            case REALLOC: /* mm_realloc */
+                p = replay_realloc(trace, i);
+                break;
+
+            case FREE: /* mm_free */
+                mm_free(trace->blocks[index]);
+                p = NULL;
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_mm_maxop");
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        if (trace->ops[i].type != FREE && p == NULL)
+            app_error("mm_malloc or mm_realloc error in eval_mm_maxop");
+        trace->blocks[index] = p;
+
+        t = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        if (t > maxop)
+            maxop = t;
+    }
+    return maxop;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -854,7 +1147,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum) {
         switch (trace->ops[i].type) {
 
             case ALLOC: /* malloc */
-                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                if ((p = libc_malloc(trace, i)) == NULL) {
                     malloc_error(tracenum, i, "libc malloc failed");
                     unix_error("System message");
                 }
@@ -890,7 +1183,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum) {
  */
 static void eval_libc_speed(void *ptr) {
     int i;
-    int index, size, newsize;
+    int index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *) ptr)->trace;
 
@@ -898,8 +1191,7 @@ static void eval_libc_speed(void *ptr) {
         switch (trace->ops[i].type) {
             case ALLOC: /* malloc */
                 index = trace->ops[i].index;
-                size = trace->ops[i].size;
-                if ((p = malloc(size)) == NULL)
+                if ((p = libc_malloc(trace, i)) == NULL)
                     unix_error("malloc failed in eval_libc_speed");
                 trace->blocks[index] = p;
                 break;
@@ -923,6 +1215,23 @@ static void eval_libc_speed(void *ptr) {
     }
 }
 
+/*
+ * libc_malloc - libc malloc for the ALLOC op ops[i], or posix_memalign
+ *     if it is an aligned one, or calloc.
+ */
+static char *libc_malloc(trace_t *trace, int i) {
+    void *p;
+
+    if (trace->ops[i].zero)
+        return calloc(1, trace->ops[i].size);
+    if (!trace->ops[i].align)
+        return malloc(trace->ops[i].size);
+
+    if (posix_memalign(&p, trace->ops[i].align, trace->ops[i].size) != 0)
+        return NULL;
+    return p;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -936,41 +1245,55 @@ static void printresults(int n, stats_t *stats) {
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double maxop = 0;
 
-    /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n",
-           "trace", " valid", "util", "ops", "secs", "Kops");
+    /* Print the individual results for each trace, the avg and max op times in usecs */
+    printf("%5s%7s %5s%8s%10s%6s%8s%8s%7s%8s\n",
+           "trace", " valid", "util", "ops", "secs", "Kops", "peakKB", "endKB", "avgus", "maxus");
     for (i = 0; i < n; i++) {
         if (stats[i].valid) {
-            printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n",
+            printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f%8.0f%8.0f%7.3f%8.1f\n",
                    i,
                    "yes",
                    stats[i].util * 100.0,
                    stats[i].ops,
                    stats[i].secs,
-                   (stats[i].ops / 1e3) / stats[i].secs);
+                   (stats[i].ops / 1e3) / stats[i].secs,
+                   stats[i].peak / 1024.0,
+                   stats[i].heap / 1024.0,
+                   stats[i].secs / stats[i].ops * 1e6,
+                   stats[i].maxop * 1e6);
             secs += stats[i].secs;
+            if (stats[i].maxop > maxop)
+                maxop = stats[i].maxop;
             ops += stats[i].ops;
             util += stats[i].util;
         } else {
-            printf("%2d%10s%6s%8s%10s%6s\n",
+            printf("%2d%10s%6s%8s%10s%6s%8s%8s%7s%8s\n",
                    i,
                    "no",
                    "-",
                    "-",
                    "-",
+                   "-",
+                   "-",
+                   "-",
+                   "-",
                    "-");
         }
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-        printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n",
+        printf("%12s%5.0f%%%8.0f%10.6f%6.0f%16s%7.3f%8.1f\n",
                "Total       ",
                (util / n) * 100.0,
                ops,
                secs,
-               (ops / 1e3) / secs);
+               (ops / 1e3) / secs,
+               "",
+               secs / ops * 1e6,
+               maxop * 1e6);
     } else {
         printf("%12s%6s%8s%10s%6s\n",
                "Total       ",
@@ -982,6 +1305,94 @@ static void printresults(int n, stats_t *stats) {
 
 }
 
+/*
+ * printcompare - prints the util and throughput of every mm allocator
+ *    side by side, one column pair per allocator, stats[b] and errs[b]
+ *    being the stats and the error count of mm_backends[b]
+ */
+static void printcompare(int n, stats_t **stats, int *errs) {
+    int i, b;
+    double ops, secs, util, p1, p2;
+
+    printf("%5s", "trace");
+    for (b = 0; mm_backends[b].name != NULL; b++)
+        printf("%16s", mm_backends[b].name);
+    printf("\n");
+
+    for (i = 0; i < n; i++) {
+        printf("%5d", i);
+        for (b = 0; mm_backends[b].name != NULL; b++) {
+            if (stats[b][i].valid)
+                printf("%9.0f%%%6.0f",
+                       stats[b][i].util * 100.0,
+                       (stats[b][i].ops / 1e3) / stats[b][i].secs);
+            else
+                printf("%10s%6s", "-", "-");
+        }
+        printf("\n");
+    }
+
+    /* the aggregate results and the performance index of every allocator */
+    printf("%5s", "Total");
+    for (b = 0; mm_backends[b].name != NULL; b++) {
+        ops = secs = util = 0;
+        for (i = 0; i < n; i++) {
+            ops += stats[b][i].ops;
+            secs += stats[b][i].secs;
+            util += stats[b][i].util;
+        }
+        if (errs[b] == 0)
+            printf("%9.0f%%%6.0f", (util / n) * 100.0, (ops / 1e3) / secs);
+        else
+            printf("%10s%6s", "-", "-");
+    }
+    printf("\n");
+
+    printf("%5s", "Perf");
+    for (b = 0; mm_backends[b].name != NULL; b++) {
+        if (errs[b] == 0)
+            printf("%16.0f", perf_index(stats[b], n, &p1, &p2));
+        else
+            printf("%16s", "-");
+    }
+    printf("\n");
+}
+
+/*
+ * printpages - prints the page size the simulated heap got, as the
+ *    throughput depends on it, and how much of the heap is in huge pages
+ */
+static void printpages(void) {
+    printf("Heap pages: %zu KB, %zu KB of the heap in huge pages\n",
+           mem_heap_pagesize() / 1024, mem_heap_hugesize() / 1024);
+}
+
+/*
+ * parse_size - reads a byte count with an optional K, M or G suffix,
+ *    returns 0 if it is not one
+ */
+static size_t parse_size(char *s) {
+    char *end;
+    size_t size;
+
+    size = strtoull(s, &end, 10);
+    switch (*end) {
+        case 'G': case 'g':
+            size <<= 10;
+            /* fall through */
+        case 'M': case 'm':
+            size <<= 10;
+            /* fall through */
+        case 'K': case 'k':
+            size <<= 10;
+            end++;
+            break;
+    }
+    if (end == s || *end != '\0')
+        return 0;
+    return size;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1019,13 +1430,24 @@ void realloc_error(int tracenum, int opnum, char *msg) {
  * usage - Explain the command line arguments
  */
 static void usage(void) {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    int i;
+
+    fprintf(stderr, "Usage: mdriver [-hvValbsx] [-f <file>] [-t <dir>] [-m <name>] [-M <size>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b         Replay runs of same-size allocs, and of frees, in batches.\n");
+    fprintf(stderr, "\t-s         Free with mm_free_sized, which is told the size of the block.\n");
+    fprintf(stderr, "\t-x         Grow a block with mm_try_expand, then mm_realloc if it must move.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-m <name>  Run the mm allocator <name>, or all of them side by side:\n");
+    fprintf(stderr, "\t           ");
+    for (i = 0; mm_backends[i].name != NULL; i++)
+        fprintf(stderr, "%s, ", mm_backends[i].name);
+    fprintf(stderr, "all.\n");
+    fprintf(stderr, "\t-M <size>  Size of the simulated heap, like 512M or 32G.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
@@ -2,7 +2,17 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            Besides the brk heap, it models a mapping facility: mem_map()
+ *            hands out page aligned regions outside the heap, each of them
+ *            given back on its own by mem_unmap().
+ *
+ *            The heap itself is an anonymous mapping aligned to the huge
+ *            page size, and advised to get transparent huge pages, so that
+ *            large traces do not pay for TLB misses. With MEM_HUGETLB it
+ *            asks for hugetlb pages first, and falls back to that.
  */
+#define _GNU_SOURCE     /* mremap() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -18,60 +28,254 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */
+static size_t mem_peak;      /* largest heap size plus mapped bytes since the last reset */
+static char *mem_clean;      /* highest brk since the heap was last zeroed, the heap is zero from here up */
+static void (*mem_reset_hook)(void);  /* called before the heap is reset */
+static size_t mem_heap_len;  /* length of the heap mapping */
+static size_t mem_max_heap = MAX_HEAP;  /* largest legal heap size, see mem_set_maxheap() */
+static int mem_hugetlb;      /* is the heap mapping backed by hugetlb pages? */
+
+/* a region handed out by mem_map() */
+typedef struct map_region {
+    char *addr;
+    size_t len;
+    struct map_region *next;
+} map_region_t;
+
+static map_region_t *mem_regions;   /* regions mapped now */
+static size_t mem_mapped;           /* bytes mapped now */
+
+#define MEM_HUGE_SIZE   (2 * (1 << 20))     /* huge page size the heap is aligned to */
+
+static void mem_update_peak(void);
+
+/*
+ * mem_map_heap - map len bytes for the heap, zeroed and aligned to
+ *    MEM_HUGE_SIZE. Returns NULL if there is no memory for it.
+ */
+static char *mem_map_heap(size_t len) {
+    char *p, *q;
+
+#ifdef MEM_HUGETLB
+    /* a hugetlb mapping is aligned already, but there may be no pages reserved for it.
+     * the pages are reserved at mmap time, so that it fails rather than a later touch
+     * of the heap, which MAP_NORESERVE would turn into a SIGBUS */
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        mem_hugetlb = 1;
+        return p;
+    }
+#endif
+
+    /* map a huge page more than needed, and cut what lies off the alignment.
+     * no swap is reserved for it, so a heap of tens of GB can be reserved too */
+    p = mmap(NULL, len + MEM_HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    q = (char *) (((size_t) p + MEM_HUGE_SIZE - 1) & ~((size_t) MEM_HUGE_SIZE - 1));
+    if (q != p)
+        munmap(p, q - p);
+    munmap(q + len, p + MEM_HUGE_SIZE - q);
+#ifdef MADV_HUGEPAGE
+    madvise(q, len, MADV_HUGEPAGE);
+#endif
+    mem_hugetlb = 0;
+    return q;
+}
+
+/*
+ * mem_set_maxheap - set the largest legal heap size to size bytes,
+ *    MAX_HEAP unless told otherwise. Call it before mem_init().
+ */
+void mem_set_maxheap(size_t size) {
+    mem_max_heap = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void) {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *) malloc(MAX_HEAP)) == NULL) {
-        fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* map the storage we will use to model the available VM, zeroed.
+     * only reserved: a page is not committed until the heap grows over it */
+    mem_heap_len = (mem_max_heap + MEM_HUGE_SIZE - 1) & ~((size_t) MEM_HUGE_SIZE - 1);
+    if ((mem_start_brk = mem_map_heap(mem_heap_len)) == NULL) {
+        fprintf(stderr, "mem_init_vm: mmap error\n");
         exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_max_addr = mem_start_brk + mem_max_heap;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_clean = mem_start_brk;
+    mem_peak = 0;
+    mem_regions = NULL;
+    mem_mapped = 0;
 }
 
 /*
- * mem_clean - clean the memory system model
+ * mem_clean - clean the memory system model. Only the heap below the
+ *    clean mark has been handed out since it was last zeroed, so only
+ *    that is zeroed again. It is not dropped with page advice: the pages
+ *    stay committed, and the next timed run takes no page faults.
  */
 void mem_clear(void) {
-    memset(mem_start_brk, 0, MAX_HEAP);
+    if (mem_reset_hook != NULL)
+        mem_reset_hook();
+    memset(mem_start_brk, 0, mem_clean - mem_start_brk);
     mem_reset_brk();
+    mem_clean = mem_start_brk;
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void) {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, mem_heap_len);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and unmap every region left over
  */
 void mem_reset_brk() {
+    map_region_t *r;
+
+    if (mem_reset_hook != NULL)
+        mem_reset_hook();
+    while ((r = mem_regions) != NULL) {
+        mem_regions = r->next;
+        munmap(r->addr, r->len);
+        free(r);
+    }
+    mem_mapped = 0;
     mem_brk = mem_start_brk;
+    mem_peak = 0;
+}
+
+/*
+ * mem_set_reset_hook - have hook called before the heap is reset, so
+ *    that an allocator working on the heap in the background can stop
+ *    until its next init
+ */
+void mem_set_reset_hook(void (*hook)(void)) {
+    mem_reset_hook = hook;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr gives the top -incr bytes of the heap back, but the
+ *    brk never goes below the start of the heap.
  */
-void *mem_sbrk(int incr) {
+void *mem_sbrk(intptr_t incr) {
     char *old_brk = mem_brk;
 
-    if ((incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if (incr < mem_start_brk - mem_brk) {
+        errno = EINVAL;
+        fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap start...\n");
+        return (void *) -1;
+    }
+    if (incr > mem_max_addr - mem_brk) {
         errno = ENOMEM;
         fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
         return (void *) -1;
     }
     mem_brk += incr;
+    if (mem_brk > mem_clean)
+        mem_clean = mem_brk;
+    mem_update_peak();
     return (void *) old_brk;
 }
 
+/*
+ * mem_map - simple model of an anonymous mmap. Returns a zeroed region
+ *    of len bytes, rounded up to the page size, outside the heap.
+ */
+void *mem_map(size_t len) {
+    map_region_t *r;
+
+    len = (len + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    if ((r = malloc(sizeof(map_region_t))) == NULL) {
+        return (void *) -1;
+    }
+    r->addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->addr == MAP_FAILED) {
+        fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+        free(r);
+        return (void *) -1;
+    }
+    r->len = len;
+    r->next = mem_regions;
+    mem_regions = r;
+    mem_mapped += len;
+    mem_update_peak();
+    return (void *) r->addr;
+}
+
+/*
+ * mem_remap - resize the region at addr to len bytes, rounded up to the
+ *    page size. The region may move, its content up to the smaller
+ *    length stays. Returns the new address.
+ */
+void *mem_remap(void *addr, size_t len) {
+    map_region_t *r;
+    char *naddr;
+
+    len = (len + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    for (r = mem_regions; r != NULL && r->addr != addr; r = r->next);
+    if (r == NULL) {
+        fprintf(stderr, "ERROR: mem_remap failed. %p is not mapped...\n", addr);
+        return (void *) -1;
+    }
+    if ((naddr = mremap(r->addr, r->len, len, MREMAP_MAYMOVE)) == MAP_FAILED) {
+        fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+        return (void *) -1;
+    }
+    mem_mapped += len - r->len;
+    r->addr = naddr;
+    r->len = len;
+    mem_update_peak();
+    return (void *) naddr;
+}
+
+/*
+ * mem_unmap - give the region at addr, from mem_map(), back
+ */
+void mem_unmap(void *addr) {
+    map_region_t **rp, *r;
+
+    for (rp = &mem_regions; *rp != NULL && (*rp)->addr != addr; rp = &(*rp)->next);
+    if ((r = *rp) == NULL) {
+        fprintf(stderr, "ERROR: mem_unmap failed. %p is not mapped...\n", addr);
+        return;
+    }
+    *rp = r->next;
+    munmap(r->addr, r->len);
+    mem_mapped -= r->len;
+    free(r);
+}
+
+/*
+ * mem_is_mapped - does [lo, hi] lie within a single mapped region?
+ */
+int mem_is_mapped(void *lo, void *hi) {
+    map_region_t *r;
+
+    for (r = mem_regions; r != NULL; r = r->next) {
+        if ((char *) lo >= r->addr && (char *) hi < r->addr + r->len)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * mem_update_peak - remember the largest footprint seen so far
+ */
+static void mem_update_peak(void) {
+    if (mem_heapsize() + mem_mapped > mem_peak)
+        mem_peak = mem_heapsize() + mem_mapped;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -86,6 +290,16 @@ void *mem_heap_hi() {
     return (void *) (mem_brk - 1);
 }
 
+/*
+ * mem_clean_lo - return address of the first heap byte that has not been
+ *    handed out by mem_sbrk() since the heap was last zeroed, by mem_init()
+ *    or mem_clear(). The heap is zero from here up to the max address. A
+ *    heap reset or trimmed below it does not lower it.
+ */
+void *mem_clean_lo() {
+    return (void *) mem_clean;
+}
+
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
@@ -93,9 +307,67 @@ size_t mem_heapsize() {
     return (size_t) (mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_mapsize() - returns the bytes of all the regions mapped now
+ */
+size_t mem_mapsize() {
+    return mem_mapped;
+}
+
+/*
+ * mem_peaksize() - returns the largest footprint, the heap size plus
+ *    the mapped bytes, since the last reset. the heap may have been
+ *    trimmed and regions unmapped below it since
+ */
+size_t mem_peaksize() {
+    return mem_peak;
+}
+
+/*
+ * mem_maxheap() - returns the largest legal heap size in bytes
+ */
+size_t mem_maxheap() {
+    return mem_max_heap;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
 size_t mem_pagesize() {
     return (size_t) getpagesize();
 }
+
+/*
+ * mem_heap_hugesize() - returns how many bytes of the heap are backed by
+ *    huge pages now: all of it with hugetlb, else the transparent huge
+ *    pages the kernel has given it, as /proc/self/smaps tells
+ */
+size_t mem_heap_hugesize() {
+    FILE *fp;
+    char line[256];
+    unsigned long lo, hi, kb;
+    int in_heap = 0;
+    size_t size = 0;
+
+    if (mem_hugetlb)
+        return mem_heap_len;
+
+    if ((fp = fopen("/proc/self/smaps", "r")) == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2)
+            in_heap = (char *) lo == mem_start_brk;
+        else if (in_heap && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+            size = kb * 1024;
+    }
+    fclose(fp);
+    return size;
+}
+
+/*
+ * mem_heap_pagesize() - returns the page size backing the heap: the huge
+ *    page size if any of it is in huge pages, else the system page size
+ */
+size_t mem_heap_pagesize() {
+    return mem_heap_hugesize() > 0 ? MEM_HUGE_SIZE : mem_pagesize();
+}
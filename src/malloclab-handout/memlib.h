@@ -1,12 +1,25 @@
+#include <stdint.h>
 #include <unistd.h>
 
+void mem_set_maxheap(size_t size);
 void mem_init(void);
 void mem_clear(void);
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
+void *mem_map(size_t len);
+void *mem_remap(void *addr, size_t len);
+void mem_unmap(void *addr);
+int mem_is_mapped(void *lo, void *hi);
 void mem_reset_brk(void); 
+void mem_set_reset_hook(void (*hook)(void));
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_clean_lo(void);
 size_t mem_heapsize(void);
+size_t mem_mapsize(void);
+size_t mem_peaksize(void);
+size_t mem_maxheap(void);
 size_t mem_pagesize(void);
+size_t mem_heap_pagesize(void);
+size_t mem_heap_hugesize(void);
 
@@ -9,14 +9,15 @@
  * NOTE TO STUDENTS: Replace this header comment with your own header
  * comment that gives a high level description of your solution.
  */
-#include "mm.h"
+#include <string.h>
+#include <stdint.h>
 
-#ifdef USE_IMPLICIT
-    #include "implicit.h"
-#endif
-#ifdef USE_SEGREGATE_FIT
-    #include "segregate.h"
-#endif
+#include "mm.h"
+#include "implicit.h"
+#include "segregate.h"
+#include "buddy.h"
+#include "tlsf.h"
+#include "utils.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -35,18 +36,90 @@ team_t team = {
     ""
 };
 
+/*
+ * the implicit allocator once per fit strategy
+ */
+static int implicit_first_init(void)
+{
+    implicit_mm_set_fit(IMPLICIT_FIRST_FIT);
+    return implicit_mm_init();
+}
+
+static int implicit_next_init(void)
+{
+    implicit_mm_set_fit(IMPLICIT_NEXT_FIT);
+    return implicit_mm_init();
+}
+
+static int implicit_best_init(void)
+{
+    implicit_mm_set_fit(IMPLICIT_BEST_FIT);
+    return implicit_mm_init();
+}
+
+/*
+ * every allocator linked in, mm_select() picks one at runtime
+ */
+mm_backend_t mm_backends[] = {
+    {"implicit-first", implicit_first_init, implicit_mm_malloc, implicit_mm_free, implicit_mm_realloc,
+            NULL, implicit_mm_memalign, implicit_mm_free_sized, implicit_mm_malloc_batch, implicit_mm_free_batch,
+            implicit_mm_usable_size, implicit_mm_try_expand},
+    {"implicit-next", implicit_next_init, implicit_mm_malloc, implicit_mm_free, implicit_mm_realloc,
+            NULL, implicit_mm_memalign, implicit_mm_free_sized, implicit_mm_malloc_batch, implicit_mm_free_batch,
+            implicit_mm_usable_size, implicit_mm_try_expand},
+    {"implicit-best", implicit_best_init, implicit_mm_malloc, implicit_mm_free, implicit_mm_realloc,
+            NULL, implicit_mm_memalign, implicit_mm_free_sized, implicit_mm_malloc_batch, implicit_mm_free_batch,
+            implicit_mm_usable_size, implicit_mm_try_expand},
+    {"segregate", segregate_mm_init, segregate_mm_malloc, segregate_mm_free, segregate_mm_realloc,
+            segregate_mm_calloc, segregate_mm_memalign, segregate_mm_free_sized, segregate_mm_malloc_batch, segregate_mm_free_batch,
+            segregate_mm_usable_size, segregate_mm_try_expand},
+    {"buddy", buddy_mm_init, buddy_mm_malloc, buddy_mm_free, buddy_mm_realloc,
+            NULL, NULL, NULL, NULL, NULL, NULL, NULL},
+    {"tlsf", tlsf_mm_init, tlsf_mm_malloc, tlsf_mm_free, tlsf_mm_realloc,
+            NULL, NULL, NULL, NULL, NULL, NULL, NULL},
+    {NULL}
+};
+
+/* the allocator at startup, STRATEGY and FIT in the Makefile */
+#if defined(USE_IMPLICIT) && defined(USE_FIRST_FIT)
+#define MM_DEFAULT  0
+#elif defined(USE_IMPLICIT) && defined(USE_NEXT_FIT)
+#define MM_DEFAULT  1
+#elif defined(USE_IMPLICIT)
+#define MM_DEFAULT  2
+#elif defined(USE_BUDDY)
+#define MM_DEFAULT  4
+#elif defined(USE_TLSF)
+#define MM_DEFAULT  5
+#else
+#define MM_DEFAULT  3
+#endif
+
+mm_backend_t *mm_backend = &mm_backends[MM_DEFAULT];
+
+/*
+ * mm_select - Make the allocator called name the current one, before mm_init().
+ *     Returns -1 if there is no such allocator.
+ */
+int mm_select(char *name)
+{
+    mm_backend_t *b;
+
+    for (b = mm_backends; b->name != NULL; b++) {
+        if (!strcmp(b->name, name)) {
+            mm_backend = b;
+            return 0;
+        }
+    }
+    return -1;
+}
+
 /* 
  * mm_init - initialize the malloc package.
  */
 int mm_init(void)
 {
-#ifdef USE_IMPLICIT
-    return implicit_mm_init();
-#endif
-#ifdef USE_SEGREGATE_FIT
-    return segregate_mm_init();
-#endif
-    return 0;
+    return mm_backend->init();
 }
 
 /* 
@@ -55,12 +128,7 @@ int mm_init(void)
  */
 void *mm_malloc(size_t size)
 {
-#ifdef USE_IMPLICIT
-    return implicit_mm_malloc(size);
-#endif
-#ifdef USE_SEGREGATE_FIT
-    return segregate_mm_malloc(size);
-#endif
+    return mm_backend->malloc(size);
 }
 
 /*
@@ -68,12 +136,7 @@ void *mm_malloc(size_t size)
  */
 void mm_free(void *ptr)
 {
-#ifdef USE_IMPLICIT
-    implicit_mm_free(ptr);
-#endif
-#ifdef USE_SEGREGATE_FIT
-    return segregate_mm_free(ptr);
-#endif
+    mm_backend->free(ptr);
 }
 
 /*
@@ -81,24 +144,116 @@ void mm_free(void *ptr)
  */
 void *mm_realloc(void *ptr, size_t size)
 {
-#ifdef USE_IMPLICIT
-    return implicit_mm_realloc(ptr, size);
-#endif
-#ifdef USE_SEGREGATE_FIT
-    return segregate_mm_realloc(ptr, size);
-#endif
+    return mm_backend->realloc(ptr, size);
 }
 
+/*
+ * mm_calloc - Allocate nmemb * size bytes of zeros. An allocator without
+ *     calloc gets its block cleared here.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *p;
 
+    if (mm_backend->calloc != NULL)
+        return mm_backend->calloc(nmemb, size);
 
+    if (size != 0 && nmemb > SIZE_MAX / size)
+        return NULL;
+    if ((p = mm_backend->malloc(nmemb * size)) != NULL)
+        memset(p, 0, nmemb * size);
+    return p;
+}
 
+/*
+ * mm_memalign - Allocate a block of size bytes at a multiple of alignment,
+ *     a power of 2. An allocator without memalign only has ALIGNMENT.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    if (mm_backend->memalign != NULL)
+        return mm_backend->memalign(alignment, size);
 
+    return alignment <= ALIGNMENT ? mm_backend->malloc(size) : NULL;
+}
 
+/*
+ * mm_aligned_alloc - mm_memalign, with the C11 rule that size is a
+ *     multiple of alignment.
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || size % alignment != 0)
+        return NULL;
 
+    return mm_memalign(alignment, size);
+}
 
+/*
+ * mm_free_sized - Free ptr, whose size the caller knows: the size last
+ *     given to mm_malloc or mm_realloc for it.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    if (mm_backend->free_sized != NULL)
+        mm_backend->free_sized(ptr, size);
+    else
+        mm_backend->free(ptr);
+}
 
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into out, at once if the
+ *     allocator can. Returns the number of blocks allocated, n unless out of memory.
+ */
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+    int i;
 
+    if (mm_backend->malloc_batch != NULL)
+        return mm_backend->malloc_batch(size, n, out);
 
+    for (i = 0; i < n && (out[i] = mm_backend->malloc(size)) != NULL; i++);
+    return i;
+}
+
+/*
+ * mm_free_batch - Free the n blocks of ptrs, at once if the allocator can.
+ *     ptrs may be reordered.
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+    int i;
 
+    if (mm_backend->free_batch != NULL) {
+        mm_backend->free_batch(ptrs, n);
+        return;
+    }
 
+    for (i = 0; i < n; i++)
+        mm_backend->free(ptrs[i]);
+}
+
+/*
+ * mm_usable_size - The number of bytes the block ptr can hold, which may
+ *     be more than asked for, or 0 if the allocator cannot tell.
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if (mm_backend->usable_size != NULL)
+        return mm_backend->usable_size(ptr);
 
+    return 0;
+}
+
+/*
+ * mm_try_expand - Grow the block ptr where it is, to hold at least min
+ *     and at most max bytes. Returns its new usable size, or 0 and leaves
+ *     the block as it was if it cannot hold min bytes without moving.
+ */
+size_t mm_try_expand(void *ptr, size_t min, size_t max)
+{
+    if (mm_backend->try_expand != NULL)
+        return mm_backend->try_expand(ptr, min, max);
+
+    return 0;
+}
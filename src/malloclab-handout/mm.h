@@ -2,8 +2,39 @@
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_malloc_batch(size_t size, int n, void **out);
+extern void mm_free_batch(void **ptrs, int n);
+extern size_t mm_usable_size(void *ptr);
+extern size_t mm_try_expand(void *ptr, size_t min, size_t max);
+
+/*
+ * Every allocator is linked in, behind mm_init/mm_malloc/mm_free/mm_realloc,
+ * and mm_select() picks the one they call by its name.
+ */
+typedef struct {
+    char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*calloc)(size_t nmemb, size_t size);             /* NULL to clear a malloc block */
+    void *(*memalign)(size_t alignment, size_t size);       /* NULL for ALIGNMENT only */
+    void (*free_sized)(void *ptr, size_t size);             /* NULL to call free */
+    int (*malloc_batch)(size_t size, int n, void **out);    /* NULL to call malloc n times */
+    void (*free_batch)(void **ptrs, int n);                 /* NULL to call free n times */
+    size_t (*usable_size)(void *ptr);                       /* NULL if unknown */
+    size_t (*try_expand)(void *ptr, size_t min, size_t max);  /* NULL to never grow in place */
+} mm_backend_t;
+
+extern mm_backend_t mm_backends[];  /* ends with a NULL name */
+extern mm_backend_t *mm_backend;    /* the current one */
+extern int mm_select(char *name);
 
 
 /* 
@@ -6,96 +6,620 @@
 #include "memlib.h"
 #include "utils.h"
 
-/* the smallest block's size we maintain*/
-#define BLK_MIN_SIZE    (BLK_HDR_SIZE + ALIGNMENT + BLK_FTR_SIZE)
+#include "config.h"
+
+/* the smallest block's size we maintain, doubly linked when free, see NEXT_FREE_BLKP() */
+#define BLK_MIN_SIZE    (BLK_HDR_SIZE + 2 * BLK_WORD_SIZE + BLK_FTR_SIZE)
+
+/* block size to alloc size bytes, no footer, but big enough to be a free block later */
+#define BLK_NEED_SIZE(size) (ALIGN((size) + BLK_HDR_SIZE) < BLK_MIN_SIZE ? BLK_MIN_SIZE : ALIGN((size) + BLK_HDR_SIZE))
 
 #define BLK_FREE    0
 #define BLK_ALLOC   1
 
-#define PACK(size, alloc) ((size) | (alloc))    /* pack size with alloc */
+/* arenas: in a thread safe build the heap is striped into ARENA_NUM arenas, each with its own
+ * freelists, slabs and lock. the arena owning a block lives in the top bits of its header
+ * and footer, so a block can be routed back without any lookup, and blocks of different
+ * arenas are never coalesced. */
+#ifndef ARENA_NUM
+#define ARENA_NUM       1
+#endif
+#ifdef BLK_WORD64
+#define ARENA_SHIFT     60                              /* so no more than 16 arenas, and blocks under 1EB */
+#else
+#define ARENA_SHIFT     28                              /* so no more than 16 arenas, and blocks under 256MB */
+#endif
+#define ARENA_CHUNK     (64 * 1024)                     /* min heap extension of an arena that does not own the tail */
+
+/* pre-zeroing: a thread of its own clears the large free blocks ahead of segregate_calloc() */
+#if defined(PREZERO) && !defined(THREAD_SAFE)
+#error "PREZERO needs THREAD_SAFE for the locks it shares with the allocator"
+#endif
 
-#define GET_SIZE(p)     (GET(p) & ~0x7)
-#define GET_ALLOC(p)    (GET(p) & 0x1)
+/* only free blocks have a footer, bit 1 of a header tells if the previous block is alloced,
+ * so that coalesce() knows whether there is a footer to look for. the bit is always 1 if the
+ * previous block belongs to another arena, so an arena never writes the header of a block it
+ * does not own, but the epilogue, see set_prev_alloc().
+ *
+ * alloc:   |hdr|          payload          |
+ * free:    |hdr|                       |ftr|
+ * */
+#define PACK(size, prev_alloc, alloc) \
+    ((size) | ((prev_alloc) << 1) | (alloc) | ((blk_word_t) arena->id << ARENA_SHIFT))  /* pack size with alloc states and arena */
+
+#define SIZE_MASK           ((((blk_word_t) 1 << ARENA_SHIFT) - 1) & ~(blk_word_t) 0x7)
+#define GET_SIZE(p)         (GET(p) & SIZE_MASK)
+#define GET_ALLOC(p)        (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p)   ((GET(p) >> 1) & 0x1)
+#define GET_ARENA(p)        (GET(p) >> ARENA_SHIFT)
+
+/* bit 2 of an alloc block header is set once the block has grown on realloc, see GROW_SIZE().
+ * any SET_BLK() clears it */
+#define BLK_GROWN_BIT       0x4
+#define BLK_GROWN(p)        (GET(BLK_HDRP(p)) & BLK_GROWN_BIT)
+#define SET_GROWN(p)        SET(BLK_HDRP(p), GET(BLK_HDRP(p)) | BLK_GROWN_BIT)
+
+/* bit 2 of a free block header is set if its payload is known zero, but for the first
+ * FREE_META_SIZE bytes, where the links are, and its footer, see segregate_calloc().
+ * only alloc blocks grow, so the bit is shared with BLK_GROWN_BIT. any SET_BLK() clears it too */
+#define BLK_ZERO_BIT        0x4
+#define BLK_ZERO(p)         (BLK_STATE(p) == BLK_FREE && (GET(BLK_HDRP(p)) & BLK_ZERO_BIT))
+#define SET_ZERO(p)         SET(BLK_HDRP(p), GET(BLK_HDRP(p)) | BLK_ZERO_BIT)
+#define FREE_META_SIZE      (4 * sizeof(void *))    /* room of the links of a free tree node, the largest */
 
 /* padding block */
-#define PADDING_BLK_SIZE    4
+#define PADDING_BLK_SIZE    BLK_WORD_SIZE
 
 /* prologue block */
-#define PB_HDR_SIZE     4
-#define PB_FTR_SIZE     4
+#define PB_HDR_SIZE     BLK_WORD_SIZE
+#define PB_FTR_SIZE     BLK_WORD_SIZE
 
 /* epilogue block */
-#define EB_HDR_SIZE     4
+#define EB_HDR_SIZE     BLK_WORD_SIZE
 
 #define EB_HDRP(p)      ((void*)(p) - EB_HDR_SIZE)          /* epilogue block header pointer */
-#define SET_EB(p)       SET(EB_HDRP(p), PACK(0, 1))         /* set epilogue block */
+#define SET_EB(p)       SET(EB_HDRP(p), PACK(0, 1, 1))      /* set epilogue block, behind an alloc one of the current arena */
 #define EB(p)           (BLK_SIZE(p) == 0 && BLK_STATE(p))         /* does p point to a epilogue block? */
 
-#define SET(p, val)     (*(unsigned int*)(p) = (val))
-#define GET(p)          (*(unsigned int*)(p))
+#ifdef THREAD_SAFE
+/* boundary tags of a neighbour in another arena are read without its lock */
+#define SET(p, val)     __atomic_store_n((blk_word_t *)(p), (val), __ATOMIC_RELAXED)
+#define GET(p)          __atomic_load_n((blk_word_t *)(p), __ATOMIC_RELAXED)
+#else
+#define SET(p, val)     (*(blk_word_t *)(p) = (val))
+#define GET(p)          (*(blk_word_t *)(p))
+#endif
 
-#define BLK_HDR_SIZE    4
-#define BLK_FTR_SIZE    4
+#define BLK_HDR_SIZE    BLK_WORD_SIZE
+#define BLK_FTR_SIZE    BLK_WORD_SIZE
 
 #define BLK_SIZE(p)             GET_SIZE(BLK_HDRP(p))
-#define BLK_AVAL_SIZE(p)        (BLK_SIZE(p) - BLK_HDR_SIZE - BLK_FTR_SIZE)
+#define BLK_AVAL_SIZE(p)        (BLK_SIZE(p) - BLK_HDR_SIZE)        /* available memory size once alloced */
 
 #define BLK_STATE(p)            (GET_ALLOC(BLK_HDRP(p)))                 /* is the block alloced? */
+#define BLK_ARENA(p)            (GET_ARENA(BLK_HDRP(p)))                 /* id of the owning arena */
 
 #define BLK_HDRP(p)             ((void*)(p) - BLK_HDR_SIZE)
-#define BLK_FTRP(p)             ((void*)(p) + BLK_AVAL_SIZE(p))
+#define BLK_FTRP(p)             ((void*)(p) + BLK_SIZE(p) - BLK_HDR_SIZE - BLK_FTR_SIZE)  /* free blocks only */
 
-#define SET_BLK(p, size, alloc)    do {                     \
-    SET(BLK_HDRP(p), PACK(size, alloc));                    \
-    SET(BLK_FTRP(p), PACK(size, alloc)); } while(0)
+/* set the block p, whose header is already in place, keeping the alloc state of its prev block */
+#define SET_BLK(p, size, alloc)     SET_BLK2(p, size, PREV_BLK_ALLOC(p), alloc)
+
+/* set the block p from scratch */
+#define SET_BLK2(p, size, prev_alloc, alloc)    do {        \
+    SET(BLK_HDRP(p), PACK(size, prev_alloc, alloc));        \
+    if ((alloc) == BLK_FREE) {                              \
+        SET(BLK_FTRP(p), PACK(size, 0, alloc));             \
+    } } while(0)
 
 /* pointer calculation */
-#define PREV_BLKP(p)    ((void*)(p) - PREV_BLK_SIZE(p))    /* prev block pointer */
+#define PREV_BLKP(p)    ((void*)(p) - PREV_BLK_SIZE(p))    /* prev block pointer, if it is free */
 #define NEXT_BLKP(p)    ((void*)(p) + BLK_SIZE(p))          /* next block pointer */
 
 #define NEXT_HDRP(p)    BLK_HDRP((void*)(p) + BLK_SIZE(p))            /* next block header pointer */
-#define PREV_FTRP(p)    ((void*)(p) - BLK_HDR_SIZE - BLK_FTR_SIZE)    /* prev block footer pointer */
+#define PREV_FTRP(p)    ((void*)(p) - BLK_HDR_SIZE - BLK_FTR_SIZE)    /* prev block footer pointer, if it is free */
 
 /* block info */
-#define PREV_BLK_ALLOC(p)   GET_ALLOC(PREV_FTRP(p))
+#define PREV_BLK_ALLOC(p)   GET_PREV_ALLOC(BLK_HDRP(p))
 #define PREV_BLK_SIZE(p)    GET_SIZE(PREV_FTRP(p))
 #define NEXT_BLK_ALLOC(p)   GET_ALLOC(NEXT_HDRP(p))
 #define NEXT_BLK_SIZE(p)    GET_SIZE(NEXT_HDRP(p))
-
-/* freelist table */
-#define FLT_SLOT_NUM    11          /* freelist_table slots number*/
+#define PREV_BLK_ARENA(p)   GET_ARENA(PREV_FTRP(p))
+#define NEXT_BLK_ARENA(p)   GET_ARENA(NEXT_HDRP(p))
+
+/* freelist table: a class holds the free blocks whose available size is in (lo, hi].
+ * up to 8 << FLT_SUB_BITS the classes are 8 bytes apart, above that every power of two is
+ * split into 1 << FLT_SUB_BITS classes, up to 4KB. blocks over 4KB go to the free tree.
+ * FLT_SUB_BITS 2: {1-8, 9-16, 17-24, 25-32, 33-40, 41-48, ..., 3585-4096, 4097-@#$}
+ * FLT_SUB_BITS 0: {1-8, 9-16, 17-32, 33-64, ..., 2049-4096, 4097-@#$} */
+#ifndef FLT_SUB_BITS
+#define FLT_SUB_BITS    2
+#endif
+#if FLT_SUB_BITS > 3
+#error "FLT_SUB_BITS > 3 needs more than 64 bits of flt_map"
+#endif
+#define FLT_SUB_NUM     (1 << FLT_SUB_BITS)
+#define FLT_TREE_MIN    4096        /* blocks larger than this go to the tree */
+#define FLT_SLOT_NUM    (FLT_SUB_NUM * (1 + 12 - 3 - FLT_SUB_BITS) + 1)     /* freelist_table slots number*/
 #define FLT_SIZE        (FLT_SLOT_NUM * sizeof(void *))
+#define FLT_LUT_MAX     1024        /* flt_index() of a size up to this is looked up in flt_lut */
 
-/* free block pointers */
-#define NEXT_FREE_BLKP(p)       ((void*) (*(uintptr_t*)(p)))
-#define PREV_FREE_BLKP(p)       ((void*) (*((uintptr_t*)(p) + 1)))
+/* free block pointers: offsets of a blk_word_t from the start of the heap, where the arenas are, so that
+ * even a BLK_MIN_SIZE block has room for both links. offset 0 is NULL, no block lives there.
+ * a freelist_table slot holds the offset of its first block the same way.
+ *
+ * |hdr|next|prev|   ......   |ftr|
+ * */
+#define FREE_OFFSET(p)          ((p) == NULL ? 0 : (blk_word_t) ((char *) (p) - (char *) arenas))
+#define FREE_PTR(off)           ((off) == 0 ? NULL : (void *) ((char *) arenas + (off)))
+
+#define NEXT_FREE_BLKP(p)       FREE_PTR(*(blk_word_t *) (p))
+#define PREV_FREE_BLKP(p)       FREE_PTR(*((blk_word_t *) (p) + 1))
 
-#define SET_NEXT_FREE_BLK(bp, next)    (*(uintptr_t*)(bp) = (uintptr_t)(next))
-#define SET_PREV_FREE_BLK(bp, prev)    (*((uintptr_t*)(bp) + 1) = (uintptr_t)(prev))
+#define SET_NEXT_FREE_BLK(bp, next)    (*(blk_word_t *) (bp) = FREE_OFFSET(next))
+#define SET_PREV_FREE_BLK(bp, prev)    (*((blk_word_t *) (bp) + 1) = FREE_OFFSET(prev))
 
 #define FREELIST_DEL_BLK(bp) do {                   \
     void *prevp, *nextp;                            \
                                                     \
-    if (BLK_SIZE(bp) > BLK_MIN_SIZE) {              \
+    if (FREETREE_HOLDS(bp)) {                       \
+        freetree_del(bp);                           \
+    } else {                                        \
         prevp = PREV_FREE_BLKP(bp);                 \
         nextp = NEXT_FREE_BLKP(bp);                 \
                                                     \
         SET_NEXT_FREE_BLK(prevp, nextp);            \
         if (nextp) {                                \
             SET_PREV_FREE_BLK(nextp, prevp);        \
+        } else if (FLT_HEADP(prevp)) {              \
+            FLT_MAP_CLR(FLT_HEAD_IDX(prevp));       \
         }                                           \
     }                                               \
 } while (0)
 
+/* flt_map: bit i is set if freelist_table[i] is not empty */
+#define FLT_MAP_SET(i)      (arena->flt_map |= 1ULL << (i))
+#define FLT_MAP_CLR(i)      (arena->flt_map &= ~(1ULL << (i)))
+#define FLT_HEAD_IDX(p)     ((void **) (p) - arena->freelist_table)
+#define FLT_HEADP(p)        ((void **) (p) >= arena->freelist_table && (void **) (p) < arena->freelist_table + FLT_SLOT_NUM)
+
+/* free tree: the last slot of the freelist_table is not a list but the root of a red-black
+ * tree of the large free blocks, ordered by size then address, so that the best fit is found
+ * in O(log n). a node lives in the payload of its block, which is over 4KB.
+ *
+ * |hdr|left|right|parent|color|   ......   |ftr|
+ * */
+#define FLT_TREE_SLOT       (FLT_SLOT_NUM - 1)
+#define FREETREE_HOLDS(bp)  (BLK_AVAL_SIZE(bp) > FLT_TREE_MIN)
+#define FREETREE_ROOTP()    (arena->freelist_table + FLT_TREE_SLOT)
+
+#define TREE_LEFT(p)        (*(void **) (p))
+#define TREE_RIGHT(p)       (*((void **) (p) + 1))
+#define TREE_PARENT(p)      (*((void **) (p) + 2))
+#define TREE_COLOR(p)       (*(unsigned int *) ((void **) (p) + 3))
+
+#define TREE_RED            0
+#define TREE_BLACK          1
+#define TREE_IS_BLACK(p)    ((p) == NULL || TREE_COLOR(p) == TREE_BLACK)
+
+/* order by size, then by address */
+#define TREE_LESS(a, b)     (BLK_SIZE(a) < BLK_SIZE(b) || (BLK_SIZE(a) == BLK_SIZE(b) && (a) < (b)))
+
+
+/* slab runs: small objects (<= SLAB_MAX_SIZE) live in page sized runs of fixed size slots,
+ * without any per-object header or footer. a run is an ordinary alloc block of the heap whose
+ * payload starts at a SLAB_RUN_SIZE aligned offset (relative to mem_heap_lo()), so that
+ * a slot pointer can be mapped back to its run by rounding down.
+ *
+ * /-------------------------SLAB_RUN_SIZE--------------------------/
+ * |hdr|run header + bitmap|slot|slot|slot| ...... |slot|            |
+ *     ^ aligned
+ * */
+#define SLAB_RUN_SIZE       4096                            /* block size of a run, including header */
+#define SLAB_MAX_SIZE       256                             /* the largest request served by slab */
+#define SLAB_CLASS_NUM      20                              /* 8, 16, ..., 128, 160, 192, 224, 256 */
+#define SLAB_TABLE_SIZE     (SLAB_CLASS_NUM * sizeof(void *))
+#define SLAB_MAP_SIZE       ALIGN(mem_maxheap() / SLAB_RUN_SIZE / 8)    /* one bit per SLAB_RUN_SIZE of the heap */
+#define SLAB_BITMAP_WORDS   ((SLAB_RUN_SIZE / ALIGNMENT + 63) / 64)
+
+#define SLAB_CLASS(size)    ((size) <= 128 ? ((size) + 7) / 8 - ((size) != 0) : 16 + ((size) - 129) / 32)
+#define SLAB_CLASS_SIZE(c)  ((c) < 16 ? ((c) + 1) * 8 : 128 + ((c) - 15) * 32)
+
+#define SLAB_OFFSET(p)      ((size_t) ((char *) (p) - (char *) mem_heap_lo()))
+#define SLAB_MAP_IDX(p)     (SLAB_OFFSET(p) / SLAB_RUN_SIZE)
+#define SLAB_OWNS(p)        (SLAB_MAP() != NULL && \
+                             ((__atomic_load_n(slab_map + SLAB_MAP_IDX(p) / 8, __ATOMIC_RELAXED) >> (SLAB_MAP_IDX(p) % 8)) & 1))
+#define SLAB_MAP()          __atomic_load_n(&slab_map, __ATOMIC_ACQUIRE)
+#define SLAB_RUNP(p)        ((slab_run_t *) ((char *) (p) - SLAB_OFFSET(p) % SLAB_RUN_SIZE))
+
+typedef struct slab_run {
+    struct slab_run *next;              /* next run of the same class that has free slots */
+    struct slab_run *prev;              /* prev run of the same class that has free slots */
+    unsigned int cls;                   /* size class of the slots */
+    unsigned int size;                  /* slot size */
+    unsigned int nslots;                /* number of slots in this run */
+    unsigned int nfree;                 /* number of free slots in this run */
+    uint64_t bitmap[SLAB_BITMAP_WORDS]; /* 1 for a used slot */
+} slab_run_t;
+
+#define SLAB_SLOTP(run)     ((char *) (run) + ALIGN(sizeof(slab_run_t)))
+
+/* fast bins: a freed block just above SLAB_MAX_SIZE is not coalesced, but stays alloc
+ * in the bin of its exact block size, linked through its first word, so that the next
+ * request of that size takes it back in O(1). the bins are merged back into the freelists
+ * only when the freelists cannot serve a request and the heap would be extended otherwise,
+ * see fastbin_consolidate(). */
+#define FASTBIN_NUM         64
+#define FASTBIN_MIN_SIZE    BLK_NEED_SIZE(SLAB_MAX_SIZE + 1)
+#define FASTBIN_MAX_SIZE    (FASTBIN_MIN_SIZE + (FASTBIN_NUM - 1) * ALIGNMENT)
+#define FASTBIN_HOLDS(bsize)    ((bsize) >= FASTBIN_MIN_SIZE && (bsize) <= FASTBIN_MAX_SIZE)
+#define FASTBIN_TABLE_SIZE      (FASTBIN_NUM * sizeof(void *))
+#define FASTBIN_IDX(bsize)      (((bsize) - FASTBIN_MIN_SIZE) / ALIGNMENT)
+
+typedef struct arena {
+    void *freelist_table[FLT_SLOT_NUM];     /* see segregate_init() */
+    uint64_t flt_map;                       /* non-empty slots of freelist_table */
+    void **fastbin;                         /* freed blocks not coalesced yet, one stack per block size, NULL until fastbin_init() */
+    uint64_t fastbin_map;                   /* non-empty fastbins */
+    slab_run_t **slab_table;                /* runs that have free slots, one list per class, NULL until slab_init() */
+    unsigned int id;
+    int last_zero;                          /* the block freelist_malloc() handed out last was known zero */
+#ifdef THREAD_SAFE
+    pthread_mutex_t lock;                   /* guards everything in this arena but remote_head */
+    void *remote_head;                      /* blocks freed without the lock, see arena_remote_free() */
+#endif
+} arena_t;
+
+#define ARENA_SIZE      ALIGN(ARENA_NUM * sizeof(arena_t))
+#define ARENA_OF(p)     (arenas + BLK_ARENA(SLAB_OWNS(p) ? (void *) SLAB_RUNP(p) : (p)))
 
-static void **freelist_table;
+
+static arena_t *arenas;             /* all the arenas, at the very beginning of the heap */
 static void *heap_listp;
 
-size_t flt_index(int v);
+static unsigned char *slab_map;     /* which SLAB_RUN_SIZE unit of the heap is a run, NULL until slab_init() */
+
+static unsigned char flt_lut[FLT_LUT_MAX / ALIGNMENT + 1];    /* flt_index() of every 8 bytes, see flt_lut_init() */
+
+#ifdef THREAD_SAFE
+static __thread arena_t *arena;     /* the arena being worked on, whose lock is held */
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;     /* guards the brk, the epilogue and slab_map */
+static unsigned int heap_epoch = 1;                                 /* bumped by every segregate_mm_init() */
+static unsigned int brk_arena;                                      /* id of the arena owning the heap tail */
+#else
+static arena_t *arena;
+#endif
+
+size_t flt_index(size_t v);
+
+size_t flt_class(size_t v);
+
+void segregate_dump(char *msg, size_t size, void *p);
+
+static void *coalesce(void *bp);
+
+void set_prev_alloc(void *bp, int prev_alloc);
+
+static void trim_heap(void *p);
+
+static void *map_alloc(size_t size);
+
+#ifdef PREZERO
+static void prezero_wake(void);
+#endif
+
+static void *freelist_find(size_t size);
+
+static void *freelist_malloc(size_t size);
+
+void freetree_del(void *bp);
+
+/******************************************
+ * free tree functions
+ ******************************************/
+
+/**
+ * Rotate the subtree at x to the left
+ * @param x
+ */
+void freetree_rotate_left(void *x) {
+    void *y;
+
+    y = TREE_RIGHT(x);
+    TREE_RIGHT(x) = TREE_LEFT(y);
+    if (TREE_LEFT(y) != NULL) {
+        TREE_PARENT(TREE_LEFT(y)) = x;
+    }
+
+    TREE_PARENT(y) = TREE_PARENT(x);
+    if (TREE_PARENT(x) == NULL) {
+        *FREETREE_ROOTP() = y;
+    } else if (x == TREE_LEFT(TREE_PARENT(x))) {
+        TREE_LEFT(TREE_PARENT(x)) = y;
+    } else {
+        TREE_RIGHT(TREE_PARENT(x)) = y;
+    }
+
+    TREE_LEFT(y) = x;
+    TREE_PARENT(x) = y;
+}
+
+/**
+ * Rotate the subtree at x to the right
+ * @param x
+ */
+void freetree_rotate_right(void *x) {
+    void *y;
+
+    y = TREE_LEFT(x);
+    TREE_LEFT(x) = TREE_RIGHT(y);
+    if (TREE_RIGHT(y) != NULL) {
+        TREE_PARENT(TREE_RIGHT(y)) = x;
+    }
+
+    TREE_PARENT(y) = TREE_PARENT(x);
+    if (TREE_PARENT(x) == NULL) {
+        *FREETREE_ROOTP() = y;
+    } else if (x == TREE_RIGHT(TREE_PARENT(x))) {
+        TREE_RIGHT(TREE_PARENT(x)) = y;
+    } else {
+        TREE_LEFT(TREE_PARENT(x)) = y;
+    }
+
+    TREE_RIGHT(y) = x;
+    TREE_PARENT(x) = y;
+}
+
+/**
+ * Put the subtree v at the place of the subtree u
+ * @param u
+ * @param v
+ */
+void freetree_transplant(void *u, void *v) {
+    if (TREE_PARENT(u) == NULL) {
+        *FREETREE_ROOTP() = v;
+    } else if (u == TREE_LEFT(TREE_PARENT(u))) {
+        TREE_LEFT(TREE_PARENT(u)) = v;
+    } else {
+        TREE_RIGHT(TREE_PARENT(u)) = v;
+    }
+
+    if (v != NULL) {
+        TREE_PARENT(v) = TREE_PARENT(u);
+    }
+}
+
+/**
+ * The smallest block of the subtree at p
+ * @param p
+ * @return
+ */
+void *freetree_min(void *p) {
+    while (TREE_LEFT(p) != NULL) {
+        p = TREE_LEFT(p);
+    }
+    return p;
+}
+
+/**
+ * The next larger block than p in the free tree
+ * @param p
+ * @return
+ */
+void *freetree_next(void *p) {
+    void *q;
+
+    if (TREE_RIGHT(p) != NULL) {
+        return freetree_min(TREE_RIGHT(p));
+    }
+
+    while ((q = TREE_PARENT(p)) != NULL && p == TREE_RIGHT(q)) {
+        p = q;
+    }
+    return q;
+}
+
+/**
+ * The smallest block of the free tree, to iterate over it with freetree_next()
+ * @return
+ */
+void *freetree_first(void) {
+    void *root;
+
+    if ((root = *FREETREE_ROOTP()) == NULL) {
+        return NULL;
+    }
+    return freetree_min(root);
+}
+
+/**
+ * Best fit
+ * @param nsize block size needed, including header and footer
+ * @return the smallest block no smaller than nsize, the lowest one if there is a tie, or NULL
+ */
+void *freetree_find(size_t nsize) {
+    void *p, *best;
+
+    best = NULL;
+    for (p = *FREETREE_ROOTP(); p != NULL;) {
+        if (BLK_SIZE(p) >= nsize) {
+            best = p;
+            p = TREE_LEFT(p);
+        } else {
+            p = TREE_RIGHT(p);
+        }
+    }
+
+    return best;
+}
+
+/**
+ *
+ * @param bp
+ */
+void freetree_insert(void *bp) {
+    void **link;
+    void *parent, *uncle, *grand;
+
+    parent = NULL;
+    for (link = FREETREE_ROOTP(); *link != NULL;) {
+        parent = *link;
+        link = TREE_LESS(bp, parent) ? &TREE_LEFT(parent) : &TREE_RIGHT(parent);
+    }
+
+    TREE_LEFT(bp) = TREE_RIGHT(bp) = NULL;
+    TREE_PARENT(bp) = parent;
+    TREE_COLOR(bp) = TREE_RED;
+    *link = bp;
+
+    /* a red node must not have a red parent */
+    while ((parent = TREE_PARENT(bp)) != NULL && TREE_COLOR(parent) == TREE_RED) {
+        grand = TREE_PARENT(parent);
+
+        if (parent == TREE_LEFT(grand)) {
+            uncle = TREE_RIGHT(grand);
+            if (!TREE_IS_BLACK(uncle)) {
+                TREE_COLOR(parent) = TREE_COLOR(uncle) = TREE_BLACK;
+                TREE_COLOR(grand) = TREE_RED;
+                bp = grand;
+                continue;
+            }
+            if (bp == TREE_RIGHT(parent)) {
+                freetree_rotate_left(parent);
+                bp = parent;
+                parent = TREE_PARENT(bp);
+            }
+            TREE_COLOR(parent) = TREE_BLACK;
+            TREE_COLOR(grand) = TREE_RED;
+            freetree_rotate_right(grand);
+        } else {
+            uncle = TREE_LEFT(grand);
+            if (!TREE_IS_BLACK(uncle)) {
+                TREE_COLOR(parent) = TREE_COLOR(uncle) = TREE_BLACK;
+                TREE_COLOR(grand) = TREE_RED;
+                bp = grand;
+                continue;
+            }
+            if (bp == TREE_LEFT(parent)) {
+                freetree_rotate_right(parent);
+                bp = parent;
+                parent = TREE_PARENT(bp);
+            }
+            TREE_COLOR(parent) = TREE_BLACK;
+            TREE_COLOR(grand) = TREE_RED;
+            freetree_rotate_left(grand);
+        }
+    }
+
+    TREE_COLOR(*FREETREE_ROOTP()) = TREE_BLACK;
+    FLT_MAP_SET(FLT_TREE_SLOT);
+}
+
+/**
+ *
+ * @param bp
+ */
+void freetree_del(void *bp) {
+    void *x, *xp, *y, *w;
+    unsigned int color;
+
+    /* 1. unlink bp, x takes the place of the node actually removed from the tree */
+    color = TREE_COLOR(bp);
+    if (TREE_LEFT(bp) == NULL) {
+        x = TREE_RIGHT(bp), xp = TREE_PARENT(bp);
+        freetree_transplant(bp, x);
+    } else if (TREE_RIGHT(bp) == NULL) {
+        x = TREE_LEFT(bp), xp = TREE_PARENT(bp);
+        freetree_transplant(bp, x);
+    } else {
+        y = freetree_min(TREE_RIGHT(bp));
+        color = TREE_COLOR(y);
+        x = TREE_RIGHT(y);
+        if (TREE_PARENT(y) == bp) {
+            xp = y;
+        } else {
+            xp = TREE_PARENT(y);
+            freetree_transplant(y, x);
+            TREE_RIGHT(y) = TREE_RIGHT(bp);
+            TREE_PARENT(TREE_RIGHT(y)) = y;
+        }
+        freetree_transplant(bp, y);
+        TREE_LEFT(y) = TREE_LEFT(bp);
+        TREE_PARENT(TREE_LEFT(y)) = y;
+        TREE_COLOR(y) = TREE_COLOR(bp);
+    }
+
+    if (*FREETREE_ROOTP() == NULL) {
+        FLT_MAP_CLR(FLT_TREE_SLOT);
+        return;
+    }
+
+    if (color == TREE_RED) {
+        return;
+    }
+
+    /* 2. a black node is gone, so x carries an extra black until it can be dropped */
+    while (x != *FREETREE_ROOTP() && TREE_IS_BLACK(x)) {
+        if (x == TREE_LEFT(xp)) {
+            w = TREE_RIGHT(xp);
+            if (!TREE_IS_BLACK(w)) {
+                TREE_COLOR(w) = TREE_BLACK;
+                TREE_COLOR(xp) = TREE_RED;
+                freetree_rotate_left(xp);
+                w = TREE_RIGHT(xp);
+            }
+            if (TREE_IS_BLACK(TREE_LEFT(w)) && TREE_IS_BLACK(TREE_RIGHT(w))) {
+                TREE_COLOR(w) = TREE_RED;
+                x = xp, xp = TREE_PARENT(x);
+                continue;
+            }
+            if (TREE_IS_BLACK(TREE_RIGHT(w))) {
+                TREE_COLOR(TREE_LEFT(w)) = TREE_BLACK;
+                TREE_COLOR(w) = TREE_RED;
+                freetree_rotate_right(w);
+                w = TREE_RIGHT(xp);
+            }
+            TREE_COLOR(w) = TREE_COLOR(xp);
+            TREE_COLOR(xp) = TREE_BLACK;
+            TREE_COLOR(TREE_RIGHT(w)) = TREE_BLACK;
+            freetree_rotate_left(xp);
+        } else {
+            w = TREE_LEFT(xp);
+            if (!TREE_IS_BLACK(w)) {
+                TREE_COLOR(w) = TREE_BLACK;
+                TREE_COLOR(xp) = TREE_RED;
+                freetree_rotate_right(xp);
+                w = TREE_LEFT(xp);
+            }
+            if (TREE_IS_BLACK(TREE_LEFT(w)) && TREE_IS_BLACK(TREE_RIGHT(w))) {
+                TREE_COLOR(w) = TREE_RED;
+                x = xp, xp = TREE_PARENT(x);
+                continue;
+            }
+            if (TREE_IS_BLACK(TREE_LEFT(w))) {
+                TREE_COLOR(TREE_RIGHT(w)) = TREE_BLACK;
+                TREE_COLOR(w) = TREE_RED;
+                freetree_rotate_left(w);
+                w = TREE_LEFT(xp);
+            }
+            TREE_COLOR(w) = TREE_COLOR(xp);
+            TREE_COLOR(xp) = TREE_BLACK;
+            TREE_COLOR(TREE_LEFT(w)) = TREE_BLACK;
+            freetree_rotate_right(xp);
+        }
+        x = *FREETREE_ROOTP();
+    }
+
+    if (x != NULL) {
+        TREE_COLOR(x) = TREE_BLACK;
+    }
+}
 
-void dump(char *msg, size_t size, void *p);
 
-void *coalesce(void *bp);
+/******************************************
+ * freelist functions
+ ******************************************/
 
 /**
  *
@@ -112,15 +636,7 @@ void freelist_insert2(void *freelistp, void *bp) {
     }
 #endif
 
-    nextp = NEXT_FREE_BLKP(freelistp);
-
-    /* no need to maintain prev pointer if it is the smallest allowed block */
-    if (BLK_SIZE(bp) == BLK_MIN_SIZE) {
-        SET_NEXT_FREE_BLK(bp, nextp);
-        SET_NEXT_FREE_BLK(freelistp, bp);
-        return;
-    }
-
+    FLT_MAP_SET(FLT_HEAD_IDX(freelistp));
     nextp = NEXT_FREE_BLKP(freelistp);
     SET_NEXT_FREE_BLK(bp, nextp);
     SET_PREV_FREE_BLK(bp, freelistp);
@@ -136,9 +652,17 @@ void freelist_insert2(void *freelistp, void *bp) {
  */
 void freelist_insert(void *bp) {
     void *p;
+    size_t index;
 
     p = coalesce(bp);
-    freelist_insert2(freelist_table + flt_index(BLK_AVAL_SIZE(p)), p);
+    if (TRIM_THRESHOLD > 0 && BLK_SIZE(p) > TRIM_THRESHOLD && EB(NEXT_BLKP(p))) {
+        trim_heap(p);
+    }
+    if ((index = flt_index(BLK_AVAL_SIZE(p))) == FLT_TREE_SLOT) {
+        freetree_insert(p);
+        return;
+    }
+    freelist_insert2(arena->freelist_table + index, p);
 }
 
 
@@ -151,46 +675,129 @@ void freelist_insert(void *bp) {
 void *freelist_alloc(void *freelistp, size_t size) {
     void *p;
     size_t nsize, bsize, rsize;
-
-    if ((p = NEXT_FREE_BLKP(freelistp)) == NULL) {
-        return NULL;
-    }
+    int zero;
 
     /* if the size > ALIGNMENT, then we may need to split a big block into two small one.
      * if the reminder will be smaller than BLK_MIN_SIZE after splitting, do not split
      * if not, insert the reminder to a right freelist
      */
-    nsize = ALIGN(size) + BLK_HDR_SIZE + BLK_FTR_SIZE;
-
-    while (p) {
-        bsize = BLK_SIZE(p);
-
-        if (bsize >= nsize) {
-            FREELIST_DEL_BLK(p);
-            rsize = bsize - nsize;
-
-            if (rsize >= BLK_MIN_SIZE) {
-                /* need to split
-                 *
-                 * /-------------------bsize--------------------/
-                 * |hdr|                                    |ftr|
-                 * |hdr|                |ftr|hdr|           |ftr|
-                 * /--------nsize-----------/-------rsize-------/
-                 *
-                 * */
-                SET_BLK(p, nsize, BLK_ALLOC);
-                SET_BLK(NEXT_BLKP(p), rsize, BLK_FREE);
-                freelist_insert(NEXT_BLKP(p));
-            } else {
-                SET_BLK(p, BLK_SIZE(p), BLK_ALLOC);
-            }
+    nsize = BLK_NEED_SIZE(size);
+
+    /* best fit in the tree, first fit in a list */
+    if (freelistp == FREETREE_ROOTP()) {
+        p = freetree_find(nsize);
+    } else {
+        for (p = NEXT_FREE_BLKP(freelistp); p != NULL && BLK_SIZE(p) < nsize; p = NEXT_FREE_BLKP(p));
+    }
+
+    if (p == NULL) {
+        return NULL;
+    }
 
-            return p;
+    bsize = BLK_SIZE(p);
+    zero = arena->last_zero = BLK_ZERO(p);
+    FREELIST_DEL_BLK(p);
+    rsize = bsize - nsize;
+
+    if (rsize >= BLK_MIN_SIZE) {
+        /* need to split
+         *
+         * /-------------------bsize--------------------/
+         * |hdr|                                    |ftr|
+         * |hdr|                    |hdr|           |ftr|
+         * /--------nsize-----------/-------rsize-------/
+         *
+         * */
+        SET_BLK(p, nsize, BLK_ALLOC);
+        SET_BLK2(NEXT_BLKP(p), rsize, BLK_ALLOC, BLK_FREE);
+        /* the reminder is still zero if the links were all in the front part */
+        if (zero && nsize >= FREE_META_SIZE) {
+            SET_ZERO(NEXT_BLKP(p));
         }
-        p = NEXT_FREE_BLKP(p);
+        freelist_insert(NEXT_BLKP(p));
+    } else {
+        SET_BLK(p, BLK_SIZE(p), BLK_ALLOC);
+        set_prev_alloc(NEXT_BLKP(p), BLK_ALLOC);
     }
 
-    return NULL;
+    return p;
+}
+
+/**
+ * Allocate the fastbins of the current arena as an ordinary block,
+ * so traces without a request in their range do not pay for them
+ * @return 0 on success
+ */
+int fastbin_init(void) {
+    void *p;
+
+    if ((p = freelist_malloc(FASTBIN_TABLE_SIZE)) == NULL) {
+        return 1;
+    }
+    memset(p, 0, FASTBIN_TABLE_SIZE);
+    arena->fastbin = p;
+
+    return 0;
+}
+
+/**
+ *
+ * @param bp an alloc block that FASTBIN_HOLDS
+ */
+void fastbin_push(void *bp) {
+    size_t i;
+
+    i = FASTBIN_IDX(BLK_SIZE(bp));
+    SET(BLK_HDRP(bp), GET(BLK_HDRP(bp)) & ~BLK_GROWN_BIT);     /* it goes back alloc, but as a new block */
+    *(void **) bp = arena->fastbin[i];
+    arena->fastbin[i] = bp;
+    arena->fastbin_map |= 1ULL << i;
+}
+
+/**
+ *
+ * @param bsize block size that FASTBIN_HOLDS
+ * @return a block of exactly bsize, or NULL if the bin is empty
+ */
+void *fastbin_pop(size_t bsize) {
+    size_t i;
+    void *bp;
+
+    i = FASTBIN_IDX(bsize);
+    if ((bp = arena->fastbin[i]) == NULL) {
+        return NULL;
+    }
+
+    if ((arena->fastbin[i] = *(void **) bp) == NULL) {
+        arena->fastbin_map &= ~(1ULL << i);
+    }
+    return bp;
+}
+
+/**
+ * Empty all the fastbins into the freelists, coalescing the blocks at last
+ * @return 0 if there was nothing to consolidate
+ */
+int fastbin_consolidate(void) {
+    size_t i;
+    uint64_t map;
+    void *bp, *next;
+
+    if ((map = arena->fastbin_map) == 0) {
+        return 0;
+    }
+
+    for (; map != 0; map &= map - 1) {
+        i = __builtin_ctzll(map);
+        for (bp = arena->fastbin[i]; bp != NULL; bp = next) {
+            next = *(void **) bp;
+            freelist_insert(bp);
+        }
+        arena->fastbin[i] = NULL;
+    }
+    arena->fastbin_map = 0;
+
+    return 1;
 }
 
 /**
@@ -200,16 +807,18 @@ void *freelist_alloc(void *freelistp, size_t size) {
  * @param size: size of memory to extend the heap
  *              NOTE: it is caller's duty to rounds up to the nearest multiple of ALIGNMENT, and
  *                    it is caller's duty to calculate the header and footer within size
- * @return the address of free memory, or NULL if failed
+ * @return the address of free memory, which is an alloc block of the current arena, or NULL if failed
  */
-void *extend_heap(int size) {
+static void *extend_heap(size_t size) {
 #ifdef DEBUG
-    printf("[DEBUG] in extend_heap(), size = %d\n", size);
+    printf("[DEBUG] in extend_heap(), size = %zu\n", size);
 #endif
 
     void *old_brk;
+    int prev_alloc;
 
-    if (size == 0) {
+    /* a size_t over INTPTR_MAX would be a shrink to mem_sbrk() */
+    if (size == 0 || size > INTPTR_MAX) {
         return NULL;
     }
 
@@ -218,15 +827,85 @@ void *extend_heap(int size) {
         return NULL;
     }
 
+    MM_LOCK(&heap_lock);
+
     /* do nothing if out of memory */
     if ((old_brk = mem_sbrk(size)) == (void *) -1) {
+        MM_UNLOCK(&heap_lock);
         return NULL;
     }
 
+    /* tag the new block before other arenas can see it as their neighbour.
+     * the old epilogue becomes its header, which tells about the tailing block if it is ours */
+    prev_alloc = GET_ARENA(EB_HDRP(old_brk)) == arena->id ? GET_PREV_ALLOC(EB_HDRP(old_brk)) : BLK_ALLOC;
+    SET_BLK2(old_brk, size, prev_alloc, BLK_ALLOC);
     SET_EB(mem_sbrk(0));
+#ifdef THREAD_SAFE
+    __atomic_store_n(&brk_arena, arena->id, __ATOMIC_RELAXED);
+#endif
+
+    MM_UNLOCK(&heap_lock);
     return old_brk;
 }
 
+/**
+ * Shrink the heap
+ * Give the tailing free block p back to memlib, but for TRIM_PAD bytes of it.
+ * nothing to do if another arena has extended the heap behind p meanwhile
+ * @param p: a free block of the current arena, not in any freelist yet
+ */
+static void trim_heap(void *p) {
+    MM_LOCK(&heap_lock);
+
+    if (NEXT_BLKP(p) == mem_sbrk(0) && mem_sbrk(-(intptr_t) (BLK_SIZE(p) - TRIM_PAD)) != (void *) -1) {
+#ifdef DEBUG
+        printf("[DEBUG] in trim_heap(), size = %zu\n", (size_t) (BLK_SIZE(p) - TRIM_PAD));
+#endif
+        SET_BLK(p, TRIM_PAD, BLK_FREE);
+        SET(EB_HDRP(mem_sbrk(0)), PACK(0, BLK_FREE, BLK_ALLOC));
+    }
+
+    MM_UNLOCK(&heap_lock);
+}
+
+
+/**
+ * Tell the block bp whether its prev block, which belongs to the current arena, is alloced.
+ * nothing to do if bp belongs to another arena. if bp is the epilogue, another arena may be
+ * turning it into a header in extend_heap() meanwhile, so look at it again under the heap_lock.
+ * @param bp
+ * @param prev_alloc
+ */
+void set_prev_alloc(void *bp, int prev_alloc) {
+    void *hdrp;
+
+    hdrp = BLK_HDRP(bp);
+    if (GET_SIZE(hdrp) == 0) {
+        MM_LOCK(&heap_lock);
+        if (GET_SIZE(hdrp) == 0 && GET_ARENA(hdrp) == arena->id) {
+            SET(hdrp, (GET(hdrp) & ~0x2) | (prev_alloc << 1));
+        }
+        MM_UNLOCK(&heap_lock);
+        return;
+    }
+
+    if (GET_ARENA(hdrp) == arena->id) {
+        SET(hdrp, (GET(hdrp) & ~0x2) | (prev_alloc << 1));
+    }
+}
+
+/**
+ * The current brk, which may be moved by another arena at any time
+ * @return
+ */
+void *heap_brk(void) {
+    void *p;
+
+    MM_LOCK(&heap_lock);
+    p = mem_sbrk(0);
+    MM_UNLOCK(&heap_lock);
+    return p;
+}
 
 
 /******************************************
@@ -238,33 +917,43 @@ void *extend_heap(int size) {
  * @param v
  * @return
  */
-size_t flt_index(int v) {
-    /**
-     * see http://graphics.stanford.edu/%7Eseander/bithacks.html#IntegerLog
-     * and http://graphics.stanford.edu/%7Eseander/bithacks.html#DetermineIfPowerOf2
-     */
-    int ret;
-    const unsigned int b[] = {0x2, 0xC, 0xF0, 0xFF00, 0xFFFF0000};
-    const unsigned int S[] = {1, 2, 4, 8, 16};
-    int i;
-    int vc = v;
+size_t flt_index(size_t v) {
+    if (v <= FLT_LUT_MAX) {
+        return flt_lut[(v + ALIGNMENT - 1) / ALIGNMENT];
+    }
+    return flt_class(v);
+}
 
-    register unsigned int r = 0; // result of log2(v) will go here
-    for (i = 4; i >= 0; i--) // unroll for speed...
-    {
-        if (v & b[i]) {
-            v >>= S[i];
-            r |= S[i];
-        }
+/**
+ * flt_index() the long way
+ * @param v
+ * @return
+ */
+size_t flt_class(size_t v) {
+    unsigned int w, k;
+
+    if (v <= ALIGNMENT * FLT_SUB_NUM) {
+        return v == 0 ? 0 : (v - 1) / ALIGNMENT;
+    }
+    if (v > FLT_TREE_MIN) {
+        return FLT_TREE_SLOT;
     }
 
-    ret = r - 3 + ((vc & (vc - 1)) != 0);
-    if (ret < 0) {
-        return 0;
-    } else if (ret > 10) {
-        return 10;
+    /* v in (2^k, 2^(k+1)], and FLT_SUB_BITS bits below the leading one pick the sub class */
+    w = v - 1;
+    k = 31 - __builtin_clz(w);
+    return FLT_SUB_NUM * (k - 2 - FLT_SUB_BITS) + ((w >> (k - FLT_SUB_BITS)) & (FLT_SUB_NUM - 1));
+}
+
+/**
+ * Fill flt_lut, for every multiple of 8 up to FLT_LUT_MAX
+ */
+void flt_lut_init(void) {
+    unsigned int v;
+
+    for (v = 0; v <= FLT_LUT_MAX; v += ALIGNMENT) {
+        flt_lut[v / ALIGNMENT] = flt_class(v);
     }
-    return ret;
 }
 
 /**
@@ -272,112 +961,1313 @@ size_t flt_index(int v) {
  * @param bp
  * @return
  */
-void *coalesce(void *bp) {
+static void *coalesce(void *bp) {
     // four cases: (1 for alloc, 0 for free)
     // prev, now, next
     // 1, 0, 1
     // 0, 0, 1
     // 1, 0, 0
     // 0, 0, 0
-    int size;
+    // a known zero block stays so unless merged, which leaves tags and links in the middle.
+    size_t size;
+    int zero;
     void *p;
 
     size = BLK_SIZE(bp);
+    zero = BLK_ZERO(bp);
     p = bp;
 
-    if (NEXT_BLK_ALLOC(bp) == BLK_FREE) {
+    if (NEXT_BLK_ARENA(bp) == arena->id && NEXT_BLK_ALLOC(bp) == BLK_FREE) {
 #ifdef DEBUG
-        printf("[DEBUG] coalescing next block: %p, size: %d\n", NEXT_BLKP(bp), NEXT_BLK_SIZE(bp));
+        printf("[DEBUG] coalescing next block: %p, size: %zu\n", NEXT_BLKP(bp), (size_t) NEXT_BLK_SIZE(bp));
 #endif
         FREELIST_DEL_BLK(NEXT_BLKP(bp));
         size += NEXT_BLK_SIZE(bp);
+        zero = 0;
     }
 
-    if (PREV_BLK_ALLOC(bp) == BLK_FREE) {
+    /* the prev block has a footer to look at only if it is free */
+    if (PREV_BLK_ALLOC(bp) == BLK_FREE && PREV_BLK_ARENA(bp) == arena->id) {
 #ifdef DEBUG
-        printf("[DEBUG] coalescing prev block: %p, size: %d\n", PREV_BLKP(bp), PREV_BLK_SIZE(bp));
+        printf("[DEBUG] coalescing prev block: %p, size: %zu\n", PREV_BLKP(bp), (size_t) PREV_BLK_SIZE(bp));
 #endif
         FREELIST_DEL_BLK(PREV_BLKP(bp));
         size += PREV_BLK_SIZE(bp);
         p = PREV_BLKP(bp);
+        zero = 0;
     }
 
     SET_BLK(p, size, BLK_FREE);
+    if (zero) {
+        SET_ZERO(p);
+    }
+    set_prev_alloc(NEXT_BLKP(p), BLK_FREE);
 
 #ifdef DUMP_HEAP
-    dump("coalesce", size, bp);
+    segregate_dump("coalesce", size, bp);
 #endif
     return p;
 }
 
 
 /******************************************
- * allocator open APIs
+ * slab functions
  ******************************************/
 
 /**
- *
- * @return
+ * Mark or unmark the run unit starting at rp in the slab_map
+ * @param rp
+ * @param on
  */
-int segregate_mm_init(void) {
-    // 1. extend the heap for the freelist_table;
-    // 2. init the freelist_table:
-    //    {1-8, 9-16, 17-32, 33-64, ..., 4097-@#$}, 11 slots, 8 bytes per slot to store a pointer (64bit platform)
-    // 3. extend the heap for padding, pb, and eb.
-    if ((freelist_table = extend_heap(FLT_SIZE + PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE + EB_HDR_SIZE)) == NULL) {
-        return 1;
+void slab_map_set(void *rp, int on) {
+    size_t idx;
+
+    /* atomic, since SLAB_OWNS() may be tested without the heap_lock in a thread safe build */
+    idx = SLAB_MAP_IDX(rp);
+    if (on) {
+        __atomic_fetch_or(slab_map + idx / 8, (unsigned char) (1 << (idx % 8)), __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(slab_map + idx / 8, (unsigned char) ~(1 << (idx % 8)), __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Push a run onto the list of its class
+ * @param run
+ */
+void slab_list_push(slab_run_t *run) {
+    run->prev = NULL;
+    run->next = arena->slab_table[run->cls];
+    if (run->next != NULL) {
+        run->next->prev = run;
+    }
+    arena->slab_table[run->cls] = run;
+}
+
+/**
+ * Remove a run from the list of its class
+ * @param run
+ */
+void slab_list_del(slab_run_t *run) {
+    if (run->prev != NULL) {
+        run->prev->next = run->next;
+    } else {
+        arena->slab_table[run->cls] = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
+    }
+    run->next = run->prev = NULL;
+}
+
+/**
+ * Find room for a run inside the free block bp
+ * @param bp
+ * @return offset of the run from bp, or -1 if bp cannot hold an aligned run
+ */
+long slab_window(void *bp) {
+    size_t lead, rest, bsize;
+
+    /* the leading fragment must be able to live as a free block by itself */
+    lead = (SLAB_RUN_SIZE - SLAB_OFFSET(bp) % SLAB_RUN_SIZE) % SLAB_RUN_SIZE;
+    if (lead != 0 && lead < BLK_MIN_SIZE) {
+        lead += SLAB_RUN_SIZE;
+    }
+
+    bsize = BLK_SIZE(bp);
+    if (bsize < lead + SLAB_RUN_SIZE) {
+        return -1;
+    }
+
+    /* so does the tailing one */
+    rest = bsize - lead - SLAB_RUN_SIZE;
+    if (rest != 0 && rest < BLK_MIN_SIZE) {
+        return -1;
+    }
+
+    return (long) lead;
+}
+
+/**
+ * Carve an aligned block for a run out of a free block, giving the fragments back
+ * @return the run block, or NULL if no free block can hold it
+ */
+void *slab_run_carve(void) {
+    void *bp, *rp;
+    size_t i, bsize;
+    long lead;
+
+    for (i = flt_index(SLAB_RUN_SIZE); i < FLT_SLOT_NUM; i++) {
+        for (bp = i == FLT_TREE_SLOT ? freetree_first() : NEXT_FREE_BLKP(arena->freelist_table + i);
+             bp != NULL;
+             bp = i == FLT_TREE_SLOT ? freetree_next(bp) : NEXT_FREE_BLKP(bp)) {
+            if ((lead = slab_window(bp)) < 0) {
+                continue;
+            }
+
+            FREELIST_DEL_BLK(bp);
+            bsize = BLK_SIZE(bp);
+            rp = bp + lead;
+
+            if (lead > 0) {
+                SET_BLK(bp, lead, BLK_FREE);
+                SET_BLK2(rp, SLAB_RUN_SIZE, BLK_FREE, BLK_ALLOC);
+            } else {
+                SET_BLK(rp, SLAB_RUN_SIZE, BLK_ALLOC);
+            }
+            if (bsize > lead + SLAB_RUN_SIZE) {
+                SET_BLK2(NEXT_BLKP(rp), bsize - lead - SLAB_RUN_SIZE, BLK_ALLOC, BLK_FREE);
+                freelist_insert(NEXT_BLKP(rp));
+            } else {
+                set_prev_alloc(NEXT_BLKP(rp), BLK_ALLOC);
+            }
+            if (lead > 0) {
+                freelist_insert(bp);
+            }
+            return rp;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Get an aligned block for a new run of class cls, from the freelists if possible,
+ * or from the heap
+ * @param cls
+ * @return the new run, or NULL if out of memory
+ */
+slab_run_t *slab_run_new(size_t cls) {
+    void *bp, *rp;
+    size_t i;
+    long lead;
+    slab_run_t *run;
+
+    /* 1. carve the run out of a free block, with the fastbins merged back if needed */
+    while ((rp = slab_run_carve()) == NULL && fastbin_consolidate());
+
+    /* 2. extend the heap, padding it up to the next aligned offset.
+     * another arena may move the brk in between, then give the block back and try again */
+    while (rp == NULL) {
+        lead = (SLAB_RUN_SIZE - SLAB_OFFSET(heap_brk()) % SLAB_RUN_SIZE) % SLAB_RUN_SIZE;
+        if (lead != 0 && lead < BLK_MIN_SIZE) {
+            lead += SLAB_RUN_SIZE;
+        }
+        if ((bp = extend_heap(lead + SLAB_RUN_SIZE)) == NULL) {
+            return NULL;
+        }
+        if (SLAB_OFFSET(bp + lead) % SLAB_RUN_SIZE != 0) {
+            SET_BLK(bp, BLK_SIZE(bp), BLK_FREE);
+            freelist_insert(bp);
+            continue;
+        }
+
+        rp = bp + lead;
+        if (lead > 0) {
+            SET_BLK(bp, lead, BLK_FREE);
+            SET_BLK2(rp, SLAB_RUN_SIZE, BLK_FREE, BLK_ALLOC);
+            freelist_insert(bp);
+        }
+    }
+
+    run = rp;
+    run->cls = cls;
+    run->size = SLAB_CLASS_SIZE(cls);
+    run->nslots = run->nfree = (SLAB_RUN_SIZE - BLK_HDR_SIZE - ALIGN(sizeof(slab_run_t))) / run->size;
+
+    /* slots beyond nslots are never handed out */
+    memset(run->bitmap, 0, sizeof(run->bitmap));
+    for (i = run->nslots; i < SLAB_BITMAP_WORDS * 64; i++) {
+        run->bitmap[i / 64] |= 1ULL << (i % 64);
+    }
+
+    slab_map_set(run, 1);
+    slab_list_push(run);
+
+    return run;
+}
+
+/**
+ * Allocate the slab_table of the current arena, and the slab_map if no arena did it yet,
+ * as ordinary blocks, so traces without small objects do not pay for them
+ * @return 0 on success
+ */
+int slab_init(void) {
+    void *p;
+
+    if (SLAB_MAP() == NULL) {
+        if ((p = freelist_malloc(SLAB_MAP_SIZE)) == NULL) {
+            return 1;
+        }
+        memset(p, 0, SLAB_MAP_SIZE);
+
+        /* another arena may have won the race */
+        MM_LOCK(&heap_lock);
+        if (slab_map == NULL) {
+            __atomic_store_n(&slab_map, p, __ATOMIC_RELEASE);
+            p = NULL;
+        }
+        MM_UNLOCK(&heap_lock);
+
+        if (p != NULL) {
+            freelist_insert(p);
+        }
+    }
+
+    if ((p = freelist_malloc(SLAB_TABLE_SIZE)) == NULL) {
+        return 1;
+    }
+    memset(p, 0, SLAB_TABLE_SIZE);
+    arena->slab_table = p;
+
+    return 0;
+}
+
+/**
+ *
+ * @param size no more than SLAB_MAX_SIZE
+ * @return
+ */
+void *slab_alloc(size_t size) {
+    size_t cls, i, bit;
+    slab_run_t *run;
+
+    if (arena->slab_table == NULL && slab_init() != 0) {
+        return NULL;
+    }
+
+    cls = SLAB_CLASS(size);
+    if ((run = arena->slab_table[cls]) == NULL && (run = slab_run_new(cls)) == NULL) {
+        return NULL;
+    }
+
+    /* a run in the list always has a free slot */
+    for (i = 0; run->bitmap[i] == ~0ULL; i++);
+    bit = __builtin_ctzll(~run->bitmap[i]);
+    run->bitmap[i] |= 1ULL << bit;
+
+    if (--run->nfree == 0) {
+        slab_list_del(run);
+    }
+
+    return SLAB_SLOTP(run) + (i * 64 + bit) * run->size;
+}
+
+/**
+ *
+ * @param ptr a slot that SLAB_OWNS
+ */
+void slab_free(void *ptr) {
+    size_t i;
+    slab_run_t *run;
+
+    run = SLAB_RUNP(ptr);
+    i = ((char *) ptr - SLAB_SLOTP(run)) / run->size;
+    run->bitmap[i / 64] &= ~(1ULL << (i % 64));
+
+    if (run->nfree++ == 0) {
+        slab_list_push(run);
+    }
+
+    /* give an empty run back to the heap, but keep the last one of its class
+     * so that a malloc/free pair does not carve and release a run every time */
+    if (run->nfree == run->nslots && (run->prev != NULL || run->next != NULL)) {
+        slab_list_del(run);
+        slab_map_set(run, 0);
+        freelist_insert(run);
+    }
+}
+
+/******************************************
+ * allocator core
+ * NOTE: callers must hold the lock of the current arena
+ ******************************************/
+
+/**
+ *
+ * @return
+ */
+static int segregate_init(void) {
+    // 1. extend the heap for the arenas, each of them has a freelist_table;
+    // 2. init the freelist_tables:
+    //    FLT_SLOT_NUM slots, 8 bytes per slot to store a pointer (64bit platform), see FLT_SUB_BITS
+    // 3. extend the heap for padding, pb, and eb.
+    // the slab_tables and the slab_map are allocated with the first small object, see slab_init(),
+    // and the fastbins with the first object in their range, see fastbin_init().
+    // NOTE: nothing to tag in an empty heap, so mem_sbrk() rather than extend_heap()
+    size_t i;
+
+    /* a free block may grow as large as the heap, and its size must fit in SIZE_MASK */
+    if (mem_maxheap() > SIZE_MASK) {
+        return -1;
+    }
+    if ((arenas = mem_sbrk(ARENA_SIZE + PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE + EB_HDR_SIZE)) == (void *) -1) {
+        return -1;
+    }
+    memset(arenas, 0, ARENA_SIZE);
+    for (i = 0; i < ARENA_NUM; i++) {
+        arenas[i].id = i;
+#ifdef THREAD_SAFE
+        pthread_mutex_init(&arenas[i].lock, NULL);
+#endif
+    }
+    arena = arenas;
+    slab_map = NULL;
+    flt_lut_init();
+#ifdef THREAD_SAFE
+    brk_arena = 0;
+#endif
+    heap_listp = (void *) arenas + ARENA_SIZE;
+
+    SET(heap_listp, 0xDEADBEEF);        /* padding block */
+    SET(heap_listp + PADDING_BLK_SIZE, PACK(PB_HDR_SIZE + PB_FTR_SIZE, BLK_ALLOC, BLK_ALLOC));     /* prologue block header */
+    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE, PACK(PB_HDR_SIZE + PB_FTR_SIZE, BLK_ALLOC, BLK_ALLOC));   /* prologue block footer */
+    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE, PACK(0, BLK_ALLOC, BLK_ALLOC)); /* epilogue block header */
+
+    heap_listp += PADDING_BLK_SIZE + PB_HDR_SIZE;
+
+    return 0;
+}
+
+/**
+ *
+ * @param size
+ * @return
+ */
+static void *segregate_malloc(size_t size) {
+    /* neither do large ones */
+    if (MAP_HOLDS(size)) {
+        return map_alloc(size);
+    }
+
+    /* small objects never touch the freelists */
+    if (size <= SLAB_MAX_SIZE) {
+        return slab_alloc(size);
+    }
+
+    if (arena->fastbin == NULL && FASTBIN_HOLDS(BLK_NEED_SIZE(size)) && fastbin_init() != 0) {
+        return NULL;
+    }
+
+    return freelist_malloc(size);
+}
+
+/**
+ * Allocate a block from the freelists, without extending the heap
+ * @param size
+ * @return the block, or NULL if no free block is big enough
+ */
+static void *freelist_find(size_t size) {
+    // 1. calculate the index N according to `size';
+    // 2. try to find a free block that big enough in the freelist_table[N]:
+    // 2.1 if found, place it, and move the reminder to the right freelist if needed;
+    // 2.2 if not found, try the next non-empty freelist_table[N+x], any block of which is big enough;
+    // 3. if cannot find any block, merge the fastbins back and try again.
+    // a block of the very size in a fastbin goes before all of them.
+    size_t index, i;
+    uint64_t map;
+    void *p, *bp;
+
+    arena->last_zero = 0;
+    if (arena->fastbin != NULL && FASTBIN_HOLDS(BLK_NEED_SIZE(size)) && (bp = fastbin_pop(BLK_NEED_SIZE(size))) != NULL) {
+        return bp;
+    }
+
+    index = flt_index(size);
+
+    /* iterate all non-empty freelist */
+    do {
+        for (map = arena->flt_map & (~0ULL << index); map != 0; map &= map - 1) {
+            i = __builtin_ctzll(map);
+            p = arena->freelist_table + i;
+            if ((bp = freelist_alloc(p, size)) != NULL) {
+#ifdef DEBUG
+                segregate_dump("alloc from freelist", size, bp);
+#endif
+                return bp;
+            }
+        }
+    } while (fastbin_consolidate());
+
+    return NULL;
+}
+
+/**
+ * Allocate a block from the freelists, or from the heap extended if none is big enough
+ * @param size
+ * @return
+ */
+static void *freelist_malloc(size_t size) {
+    size_t bsize, esize;
+    void *bp;
+
+    if ((bp = freelist_find(size)) != NULL) {
+        return bp;
+    }
+
+    /* no room in freelist */
+    bsize = esize = BLK_NEED_SIZE(size);
+#ifdef THREAD_SAFE
+    /* another arena owns the heap tail, take a whole chunk so that arenas do not interleave block by block */
+    if (__atomic_load_n(&brk_arena, __ATOMIC_RELAXED) != arena->id && bsize + BLK_MIN_SIZE <= ARENA_CHUNK) {
+        esize = ARENA_CHUNK;
+    }
+#endif
+    if ((bp = extend_heap(esize)) == NULL) {
+        return NULL;
+    }
+
+    if (esize > bsize) {
+        SET_BLK(bp, bsize, BLK_ALLOC);
+        SET_BLK2(NEXT_BLKP(bp), esize - bsize, BLK_ALLOC, BLK_FREE);
+        freelist_insert(NEXT_BLKP(bp));
+    }
+#ifdef DEBUG
+    segregate_dump("alloc from heap", size, bp);
+#endif
+    return bp;
+}
+
+/**
+ * Allocate a block of bsize bytes at the tail of the heap. if the tailing block is a free one
+ * of the current arena, the heap is extended by the rest only, as segregate_grow() does
+ * @param bsize: block size, header included, a multiple of ALIGNMENT
+ * @return an alloc block, or NULL if failed
+ */
+static void *tail_malloc(size_t bsize) {
+    void *brk, *tailp, *p;
+
+    /* the epilogue tells about the tailing block if it is ours */
+    MM_LOCK(&heap_lock);
+    brk = mem_sbrk(0);
+    tailp = GET_ARENA(EB_HDRP(brk)) == arena->id && GET_PREV_ALLOC(EB_HDRP(brk)) == BLK_FREE ? PREV_BLKP(brk) : NULL;
+    MM_UNLOCK(&heap_lock);
+
+    if (tailp == NULL) {
+        return extend_heap(bsize);
+    }
+    if ((p = extend_heap(bsize - BLK_SIZE(tailp))) == NULL) {
+        return NULL;
+    }
+
+    /* another arena has extended the heap meanwhile, so the new block is not ours to merge */
+    if (p != brk) {
+        freelist_insert(p);
+        return NULL;
+    }
+    FREELIST_DEL_BLK(tailp);
+    SET_BLK(tailp, bsize, BLK_ALLOC);
+    return tailp;
+}
+
+/**
+ * Free a block of the heap that is not a slab slot
+ * @param ptr
+ */
+static void segregate_free_blk(void *ptr) {
+    if (arena->fastbin != NULL && FASTBIN_HOLDS(BLK_SIZE(ptr))) {
+        fastbin_push(ptr);
+        return;
+    }
+
+#ifdef PREZERO
+    if (BLK_AVAL_SIZE(ptr) > FLT_TREE_MIN) {
+        prezero_wake();
+    }
+#endif
+    freelist_insert(ptr);
+#ifdef DEBUG
+    segregate_dump("free", BLK_AVAL_SIZE(ptr), ptr);
+#endif
+}
+
+/**
+ *
+ * @param ptr
+ */
+static void segregate_free(void *ptr) {
+    if (SLAB_OWNS(ptr)) {
+        slab_free(ptr);
+        return;
+    }
+
+    segregate_free_blk(ptr);
+}
+
+/**
+ * Grow the block ptr to nsize bytes without copying it to a new block
+ * @param ptr
+ * @param nsize: block size needed, larger than the current one
+ * @param gsize: block size wanted, with headroom, no less than nsize
+ * @param move: may the block move down to its prev block?
+ * @return the grown block, which may have moved down to its prev block, or NULL if it cannot grow in place
+ */
+static void *segregate_grow(void *ptr, size_t nsize, size_t gsize, int move) {
+    // 1. absorb the free next block, if it is enough;
+    // 2. absorb the free prev block as well, if they are enough together and move is set,
+    //    and memmove the payload down;
+    // 3. if the block, or the free next block, is the tail of the heap, extend the heap by the rest,
+    //    but for the headroom, which costs no copy there;
+    // 4. keep up to gsize, give anything over it back to the freelists.
+    void *p, *nbp, *tailp;
+    size_t bsize, fsize, psize;
+
+    bsize = BLK_SIZE(ptr);
+    nbp = NEXT_BLKP(ptr);
+    fsize = NEXT_BLK_ARENA(ptr) == arena->id && NEXT_BLK_ALLOC(ptr) == BLK_FREE ? BLK_SIZE(nbp) : 0;
+    psize = move && PREV_BLK_ALLOC(ptr) == BLK_FREE && PREV_BLK_ARENA(ptr) == arena->id ? PREV_BLK_SIZE(ptr) : 0;
+    p = ptr;
+
+    if (bsize + fsize >= nsize) {
+        if (fsize != 0) {
+            FREELIST_DEL_BLK(nbp);
+        }
+        bsize += fsize;
+    } else if (psize != 0 && psize + bsize + fsize >= nsize) {
+        if (fsize != 0) {
+            FREELIST_DEL_BLK(nbp);
+        }
+        p = PREV_BLKP(ptr);
+        FREELIST_DEL_BLK(p);
+        memmove(p, ptr, BLK_AVAL_SIZE(ptr));
+        bsize += psize + fsize;
+    } else {
+        tailp = fsize != 0 ? NEXT_BLKP(nbp) : nbp;
+        if (!EB(tailp) || (p = extend_heap(nsize - bsize - fsize)) == NULL) {
+            return NULL;
+        }
+
+        /* another arena has extended the heap meanwhile, so the new block is not ours to merge */
+        if (p != tailp) {
+            freelist_insert(p);
+            return NULL;
+        }
+        if (fsize != 0) {
+            FREELIST_DEL_BLK(nbp);
+        }
+        p = ptr;
+        bsize = nsize;
+    }
+
+    nsize = bsize < gsize ? bsize : gsize;
+    if (bsize - nsize >= BLK_MIN_SIZE) {
+        SET_BLK(p, nsize, BLK_ALLOC);
+        SET_BLK2(NEXT_BLKP(p), bsize - nsize, BLK_ALLOC, BLK_FREE);
+        freelist_insert(NEXT_BLKP(p));
+    } else {
+        SET_BLK(p, bsize, BLK_ALLOC);
+        set_prev_alloc(NEXT_BLKP(p), BLK_ALLOC);
+    }
+
+#ifdef DEBUG
+    segregate_dump("grow in place", nsize, p);
+#endif
+    return p;
+}
+
+/**
+ *
+ * @param ptr
+ * @param size
+ * @return
+ */
+static void *segregate_realloc(void *ptr, size_t size) {
+    size_t nsize, bsize, gsize, avasize;
+    void *np;
+
+    if (ptr == NULL) {
+        return segregate_malloc(size);
+    }
+
+    if (size == 0) {
+        segregate_free(ptr);
+        return NULL;
+    }
+
+    /* a slot can only grow up to its class size */
+    if (SLAB_OWNS(ptr)) {
+        avasize = SLAB_RUNP(ptr)->size;
+        if (size <= avasize) {
+            return ptr;
+        }
+        if ((np = segregate_malloc(size)) == NULL) {
+            return NULL;
+        }
+        memcpy(np, ptr, avasize);
+        slab_free(ptr);
+        return np;
+    }
+
+    nsize = BLK_NEED_SIZE(size), bsize = BLK_SIZE(ptr);
+
+    /* need more space, copy only if the block cannot grow where it is.
+     * a block growing again gets some headroom, see GROW_SIZE() */
+    if (nsize > bsize) {
+        gsize = BLK_GROWN(ptr) ? GROW_SIZE(bsize, nsize) : nsize;
+        if ((np = segregate_grow(ptr, nsize, gsize, 1)) != NULL) {
+            SET_GROWN(np);
+            return np;
+        }
+        if ((np = segregate_malloc(gsize - BLK_HDR_SIZE)) == NULL) {
+            return NULL;
+        }
+        memcpy(np, ptr, BLK_AVAL_SIZE(ptr));
+        segregate_free(ptr);
+        if (!MAP_OWNS(np) && !SLAB_OWNS(np)) {
+            SET_GROWN(np);
+        }
+        return np;
+    }
+
+    /* still within the headroom of a grown block */
+    if (BLK_GROWN(ptr) && GROW_KEEPS(bsize, nsize)) {
+        return ptr;
+    }
+
+    /* if shrink, need to insert the reminder to freelist */
+    if (bsize - nsize >= BLK_MIN_SIZE) {
+        SET_BLK(ptr, nsize, BLK_ALLOC);
+        SET_BLK2(NEXT_BLKP(ptr), bsize - nsize, BLK_ALLOC, BLK_FREE);
+        freelist_insert(NEXT_BLKP(ptr));
+    }
+
+    return ptr;
+}
+
+/**
+ * Bytes the block ptr can hold, which may be more than asked for
+ * @param ptr
+ * @return
+ */
+static size_t segregate_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    if (MAP_OWNS(ptr)) {
+        return MAP_AVAL_SIZE(ptr);
+    }
+    if (SLAB_OWNS(ptr)) {
+        return SLAB_RUNP(ptr)->size;
+    }
+    return BLK_AVAL_SIZE(ptr);
+}
+
+/**
+ * Grow the heap block ptr where it is, to hold min bytes at least and max bytes at most,
+ * see segregate_grow(), which never moves it here
+ * @param ptr: neither a slab slot nor a mapped block
+ * @param min: more than the usable size of ptr
+ * @param max
+ * @return the usable size of the block, or 0 if it cannot hold min bytes without moving
+ */
+static size_t segregate_try_expand(void *ptr, size_t min, size_t max) {
+    size_t nsize;
+
+    nsize = BLK_NEED_SIZE(min);
+    if (segregate_grow(ptr, nsize, max > min ? BLK_NEED_SIZE(max) : nsize, 0) == NULL) {
+        return 0;
+    }
+    return BLK_AVAL_SIZE(ptr);
+}
+
+/**
+ * Allocate size bytes at a multiple of alignment
+ * @param alignment: a power of 2
+ * @param size
+ * @return
+ */
+static void *segregate_memalign(size_t alignment, size_t size) {
+    // 1. take a block with room for size bytes at any alignment, after a leading fragment;
+    // 2. give the leading fragment back to the freelists, so it is not wasted;
+    // 3. give the tail back too, if it is big enough.
+    // aligned blocks always come from the freelists: neither a slab slot nor a mapped block
+    // can move its start.
+    void *p, *q;
+    size_t lsize, nsize, rsize;
+
+    if (alignment <= ALIGNMENT) {
+        return segregate_malloc(size);
+    }
+    if (size == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+
+    if ((p = freelist_malloc(size + alignment + BLK_MIN_SIZE)) == NULL) {
+        return NULL;
+    }
+
+    /* a leading fragment must be big enough to be a block */
+    q = (void *) (((size_t) p + alignment - 1) & ~(alignment - 1));
+    while (q != p && q - p < BLK_MIN_SIZE) {
+        q += alignment;
+    }
+
+    lsize = q - p;
+    if (lsize > 0) {
+        SET_BLK2(q, BLK_SIZE(p) - lsize, BLK_FREE, BLK_ALLOC);
+        SET_BLK(p, lsize, BLK_FREE);
+        freelist_insert(p);
+    }
+
+    nsize = BLK_NEED_SIZE(size);
+    if ((rsize = BLK_SIZE(q) - nsize) >= BLK_MIN_SIZE) {
+        SET_BLK(q, nsize, BLK_ALLOC);
+        SET_BLK2(NEXT_BLKP(q), rsize, BLK_ALLOC, BLK_FREE);
+        freelist_insert(NEXT_BLKP(q));
+    }
+
+#ifdef DEBUG
+    segregate_dump("memalign", size, q);
+#endif
+    return q;
+}
+
+/**
+ * Allocate size bytes of zeros, but write the zeros only where they are not known:
+ * a mapped region is fresh from mem_map(), the heap is zero from mem_clean_lo() up,
+ * and a known zero free block only has its links and footer to clear, see BLK_ZERO()
+ * @param size: more than SLAB_MAX_SIZE
+ * @return
+ */
+static void *segregate_calloc(size_t size) {
+    void *p, *lo;
+
+    lo = mem_clean_lo();
+    if ((p = segregate_malloc(size)) == NULL || MAP_OWNS(p)) {
+        return p;
+    }
+
+    if (arena->last_zero) {
+        memset(p, 0, size < FREE_META_SIZE ? size : FREE_META_SIZE);
+        if (BLK_FTRP(p) < p + size) {
+            memset(BLK_FTRP(p), 0, BLK_FTR_SIZE);
+        }
+    } else if (p < lo) {
+        /* a block from the heap extended just now is zero above the old clean mark */
+        memset(p, 0, (size_t) (lo - p) < size ? (size_t) (lo - p) : size);
+    }
+    return p;
+}
+
+#ifdef THREAD_SAFE
+/******************************************
+ * arenas
+ ******************************************/
+
+static __thread arena_t *home_arena;        /* where this thread allocates from */
+static unsigned int next_arena;             /* round robin for threads coming in */
+
+#define ARENA_LOCK()            arena_lock()
+#define ARENA_LOCK_OWNER(p)     do { arena = ARENA_OF(p); MM_LOCK(&arena->lock); } while (0)
+#define ARENA_UNLOCK()          MM_UNLOCK(&arena->lock)
+
+/**
+ * Hand a block over to its owner without taking any lock. the remote list is a stack
+ * that many threads push onto, but only the owner takes it, all at once, so there is no ABA.
+ * @param owner
+ * @param ptr
+ */
+static void arena_remote_free(arena_t *owner, void *ptr) {
+    void *head;
+
+    head = __atomic_load_n(&owner->remote_head, __ATOMIC_RELAXED);
+    do {
+        *(void **) ptr = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote_head, &head, ptr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * Free, and coalesce, everything handed over to the current arena
+ */
+static void arena_drain(void) {
+    void *p, *next;
+
+    if (__atomic_load_n(&arena->remote_head, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+
+    for (p = __atomic_exchange_n(&arena->remote_head, NULL, __ATOMIC_ACQUIRE); p != NULL; p = next) {
+        next = *(void **) p;
+        segregate_free(p);
+    }
+}
+
+/**
+ * Lock an arena to allocate from: the home arena if nobody holds it, or else the first
+ * free one, which becomes the new home. block on the home arena only if all of them are busy.
+ * this is the slow path of an allocation, so blocks freed remotely are taken back here.
+ */
+static void arena_lock(void) {
+    size_t i;
+
+    for (i = 0; i < ARENA_NUM; i++) {
+        arena = arenas + (home_arena->id + i) % ARENA_NUM;
+        if (pthread_mutex_trylock(&arena->lock) == 0) {
+            home_arena = arena;
+            arena_drain();
+            return;
+        }
+    }
+
+    arena = home_arena;
+    MM_LOCK(&arena->lock);
+    arena_drain();
+}
+
+/******************************************
+ * thread cache
+ ******************************************/
+
+/* every thread keeps up to TCACHE_MAX free slots per slab class, linked through
+ * the first word of the slots, so a malloc/free pair of a small object takes no lock.
+ * slots move between a cache and the slabs TCACHE_BATCH at a time. */
+#define TCACHE_MAX      32
+#define TCACHE_BATCH    16
+
+static __thread void *tcache_head[SLAB_CLASS_NUM];
+static __thread unsigned int tcache_count[SLAB_CLASS_NUM];
+static __thread unsigned int tcache_epoch;  /* heap_epoch when this thread was set up, 0 if never */
+
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+#define TCACHE_PUSH(cls, p) do {                    \
+    *(void **) (p) = tcache_head[cls];              \
+    tcache_head[cls] = (p);                         \
+    tcache_count[cls]++; } while (0)
+
+#define TCACHE_POP(cls, p) do {                     \
+    (p) = tcache_head[cls];                         \
+    tcache_head[cls] = *(void **) (p);              \
+    tcache_count[cls]--; } while (0)
+
+/**
+ * Give n slots of class cls back to the slabs of their own arenas
+ * @param cls
+ * @param n
+ */
+static void tcache_flush(size_t cls, size_t n) {
+    void *p;
+    arena_t *owner;
+
+    arena = NULL;
+    while (n-- > 0 && tcache_count[cls] > 0) {
+        TCACHE_POP(cls, p);
+
+        /* slots of the same run come in a row, switch lock only when the owner changes */
+        if ((owner = ARENA_OF(p)) != arena) {
+            if (arena != NULL) {
+                ARENA_UNLOCK();
+            }
+            arena = owner;
+            MM_LOCK(&arena->lock);
+        }
+        slab_free(p);
+    }
+
+    if (arena != NULL) {
+        ARENA_UNLOCK();
+    }
+}
+
+/**
+ * Thread exit hook, give all cached slots back to the shared heap
+ * @param unused
+ */
+static void tcache_release(void *unused) {
+    size_t cls;
+
+    if (tcache_epoch == __atomic_load_n(&heap_epoch, __ATOMIC_ACQUIRE)) {
+        for (cls = 0; cls < SLAB_CLASS_NUM; cls++) {
+            tcache_flush(cls, TCACHE_MAX);
+        }
+    }
+    tcache_epoch = 0;
+}
+
+static void tcache_key_init(void) {
+    pthread_key_create(&tcache_key, tcache_release);
+}
+
+/**
+ * Set up the home arena and the cache of the calling thread the first time it comes,
+ * and drop them if the heap was re-initialized since
+ */
+static void thread_check(void) {
+    unsigned int epoch;
+
+    if (tcache_epoch == (epoch = __atomic_load_n(&heap_epoch, __ATOMIC_ACQUIRE))) {
+        return;
+    }
+
+    pthread_once(&tcache_once, tcache_key_init);
+    pthread_setspecific(tcache_key, (void *) 1);    /* any non-NULL value to get tcache_release() called */
+
+    memset(tcache_head, 0, sizeof(tcache_head));
+    memset(tcache_count, 0, sizeof(tcache_count));
+    home_arena = arenas + __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % ARENA_NUM;
+    tcache_epoch = epoch;
+}
+
+/**
+ *
+ * @param size no more than SLAB_MAX_SIZE
+ * @return
+ */
+static void *tcache_alloc(size_t size) {
+    size_t cls, n;
+    void *p;
+
+    cls = SLAB_CLASS(size);
+
+    /* refill in a batch */
+    if (tcache_count[cls] == 0) {
+        ARENA_LOCK();
+        for (n = 0; n < TCACHE_BATCH; n++) {
+            if ((p = slab_alloc(SLAB_CLASS_SIZE(cls))) == NULL) {
+                break;
+            }
+            TCACHE_PUSH(cls, p);
+        }
+        ARENA_UNLOCK();
+
+        if (tcache_count[cls] == 0) {
+            return NULL;
+        }
+    }
+
+    TCACHE_POP(cls, p);
+    return p;
+}
+
+/**
+ *
+ * @param ptr a slot that SLAB_OWNS
+ */
+static void tcache_free(void *ptr) {
+    size_t cls;
+    arena_t *owner;
+
+    /* slots of other arenas go home */
+    if ((owner = ARENA_OF(ptr)) != home_arena) {
+        arena_remote_free(owner, ptr);
+        return;
+    }
+
+    cls = SLAB_RUNP(ptr)->cls;
+
+    /* flush in a batch */
+    if (tcache_count[cls] == TCACHE_MAX) {
+        tcache_flush(cls, TCACHE_BATCH);
     }
-    memset(freelist_table, 0, FLT_SIZE);
-    heap_listp = freelist_table + FLT_SLOT_NUM;
 
-    SET(heap_listp, 0xDEADBEEF);        /* padding block */
-    SET(heap_listp + PADDING_BLK_SIZE, PACK(8, BLK_ALLOC));     /* prologue block header */
-    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE, PACK(8, BLK_ALLOC));   /* prologue block footer */
-    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE, PACK(0, BLK_ALLOC)); /* epilogue block header */
+    TCACHE_PUSH(cls, ptr);
+}
+#else
+#define ARENA_LOCK()
+#define ARENA_LOCK_OWNER(p)
+#define ARENA_UNLOCK()
+#endif
 
-    heap_listp += PADDING_BLK_SIZE + PB_HDR_SIZE;
+#ifdef PREZERO
+/******************************************
+ * pre-zeroing
+ * NOTE: a block is cleared under the prezero_lock, which segregate_mm_init() and the memlib
+ * reset hook take too, so that no block is being cleared while the heap is reset or set up
+ ******************************************/
 
-    return 0;
+static pthread_once_t prezero_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t prezero_lock = PTHREAD_MUTEX_INITIALIZER;       /* held while a block is cleared */
+static pthread_mutex_t prezero_wake_lock = PTHREAD_MUTEX_INITIALIZER;  /* guards prezero_pending */
+static pthread_cond_t prezero_cond = PTHREAD_COND_INITIALIZER;
+static int prezero_pending;                                            /* a large block was freed */
+static int prezero_stale = 1;                                          /* the heap was reset, wait for init */
+
+/**
+ * Find a node of the free tree that is not known zero yet
+ * @param node
+ * @return
+ */
+static void *prezero_find(void *node) {
+    void *p;
+
+    if (node == NULL || !BLK_ZERO(node)) {
+        return node;
+    }
+    if ((p = prezero_find(TREE_LEFT(node))) != NULL) {
+        return p;
+    }
+    return prezero_find(TREE_RIGHT(node));
 }
 
 /**
- *
- * @param size
+ * Clear one large free block of the arena a. the block is taken out of the tree as an alloc one,
+ * cleared without the lock, so that the arena goes on meanwhile, then given back as known zero
+ * @param a
+ * @return 0 if every large free block of a is known zero already
+ */
+static int prezero_one(arena_t *a) {
+    void *bp;
+
+    MM_LOCK(&a->lock);
+    arena = a;
+    if ((bp = prezero_find(*FREETREE_ROOTP())) == NULL) {
+        MM_UNLOCK(&a->lock);
+        return 0;
+    }
+    freetree_del(bp);
+    SET_BLK(bp, BLK_SIZE(bp), BLK_ALLOC);
+    set_prev_alloc(NEXT_BLKP(bp), BLK_ALLOC);
+    MM_UNLOCK(&a->lock);
+
+    memset(bp, 0, BLK_AVAL_SIZE(bp));
+
+    MM_LOCK(&a->lock);
+    SET_BLK(bp, BLK_SIZE(bp), BLK_FREE);
+    SET_ZERO(bp);
+    freelist_insert(bp);
+    MM_UNLOCK(&a->lock);
+    return 1;
+}
+
+/**
+ * The pre-zeroing thread: clear every large free block of every arena each time it is woken
+ * @param unused
  * @return
  */
-void *segregate_mm_malloc(size_t size) {
-    // 1. calculate the index N according to `size';
-    // 2. try to find a free block that big enough in the freelist_table[N]:
-    // 2.1 if found, place it, and move the reminder to the right freelist if needed;
-    // 2.2 if not found, try freelist_table[N+1], continually, until nothing to check;
-    // 3. if cannot find any block, try to extend the heap.
-    size_t index, i, bsize;
-    void *p, *bp;
+static void *prezero_main(void *unused) {
+    unsigned int i;
+    int busy;
+
+    for (;;) {
+        MM_LOCK(&prezero_wake_lock);
+        while (!prezero_pending) {
+            pthread_cond_wait(&prezero_cond, &prezero_wake_lock);
+        }
+        prezero_pending = 0;
+        MM_UNLOCK(&prezero_wake_lock);
+
+        do {
+            busy = 0;
+            for (i = 0; i < ARENA_NUM; i++) {
+                MM_LOCK(&prezero_lock);
+                if (!prezero_stale) {
+                    busy |= prezero_one(arenas + i);
+                }
+                MM_UNLOCK(&prezero_lock);
+            }
+        } while (busy);
+    }
+    return NULL;
+}
 
-    index = flt_index(size);
+/**
+ * Called by memlib before the heap is reset: no block is cleared until the next init
+ */
+static void prezero_stop(void) {
+    MM_LOCK(&prezero_lock);
+    prezero_stale = 1;
+    MM_UNLOCK(&prezero_lock);
+}
 
-    /* iterate all freelist */
-    for (i = index; i < FLT_SLOT_NUM; i++) {
-        p = freelist_table + i;
-        if ((bp = freelist_alloc(p, size)) != NULL) {
-#ifdef DEBUG
-            dump("alloc from freelist", size, bp);
+/**
+ * Start the pre-zeroing thread, once
+ */
+static void prezero_start(void) {
+    pthread_t tid;
+
+    mem_set_reset_hook(prezero_stop);
+    if (pthread_create(&tid, NULL, prezero_main, NULL) == 0) {
+        pthread_detach(tid);
+    }
+}
+
+/**
+ * Tell the pre-zeroing thread a large block was freed
+ * NOTE: called with an arena lock held, prezero_wake_lock is never held long
+ */
+static void prezero_wake(void) {
+    if (__atomic_load_n(&prezero_pending, __ATOMIC_RELAXED)) {
+        return;
+    }
+    MM_LOCK(&prezero_wake_lock);
+    prezero_pending = 1;
+    pthread_cond_signal(&prezero_cond);
+    MM_UNLOCK(&prezero_wake_lock);
+}
 #endif
-            return bp;
+
+/******************************************
+ * mapped blocks
+ * NOTE: no arena lock needed, memlib is guarded by the heap_lock
+ ******************************************/
+
+/**
+ * Map a region of its own for a large block
+ * @param size
+ * @return the payload, or NULL if failed
+ */
+static void *map_alloc(size_t size) {
+    void *p;
+    size_t len;
+
+    len = MAP_NEED_LEN(size);
+    MM_LOCK(&heap_lock);
+    p = mem_map(len);
+    MM_UNLOCK(&heap_lock);
+    if (p == (void *) -1) {
+        return NULL;
+    }
+    p += MAP_HDR_SIZE;
+    MAP_LEN(p) = len;
+    return p;
+}
+
+/**
+ * Give the whole region of a mapped block back
+ * @param ptr
+ */
+static void map_free(void *ptr) {
+    MM_LOCK(&heap_lock);
+    mem_unmap(ptr - MAP_HDR_SIZE);
+    MM_UNLOCK(&heap_lock);
+}
+
+/**
+ * Resize a mapped block: remap it while it is still large, or move it into the heap
+ * @param ptr
+ * @param size
+ * @return
+ */
+static void *map_realloc(void *ptr, size_t size) {
+    void *p;
+    size_t len;
+
+    if (MAP_HOLDS(size)) {
+        if ((len = MAP_NEED_LEN(size)) == MAP_LEN(ptr)) {
+            return ptr;
+        }
+        MM_LOCK(&heap_lock);
+        p = mem_remap(ptr - MAP_HDR_SIZE, len);
+        MM_UNLOCK(&heap_lock);
+        if (p == (void *) -1) {
+            return NULL;
         }
+        p += MAP_HDR_SIZE;
+        MAP_LEN(p) = len;
+        return p;
     }
 
-    /* no room in freelist */
-    bsize = ALIGN(size) + BLK_HDR_SIZE + BLK_FTR_SIZE;
-    if ((bp = extend_heap(bsize)) == NULL) {
+    if ((p = segregate_mm_malloc(size)) == NULL) {
         return NULL;
     }
+    memcpy(p, ptr, size);
+    map_free(ptr);
+    return p;
+}
 
-    SET_BLK(bp, bsize, BLK_ALLOC);
-#ifdef DEBUG
-    dump("alloc from heap", size, bp);
+/******************************************
+ * allocator open APIs
+ ******************************************/
+
+/**
+ *
+ * @return
+ */
+int segregate_mm_init(void) {
+    int ret;
+
+#ifdef PREZERO
+    pthread_once(&prezero_once, prezero_start);
+    MM_LOCK(&prezero_lock);
 #endif
-    return bp;
+    MM_LOCK(&heap_lock);
+    ret = segregate_init();
+#ifdef THREAD_SAFE
+    /* every thread set up before is stale now */
+    __atomic_store_n(&next_arena, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&heap_epoch, 1, __ATOMIC_RELEASE);
+#endif
+    MM_UNLOCK(&heap_lock);
+#ifdef PREZERO
+    prezero_stale = ret < 0;
+    MM_UNLOCK(&prezero_lock);
+#endif
+
+    return ret;
+}
+
+/**
+ *
+ * @param size
+ * @return
+ */
+void *segregate_mm_malloc(size_t size) {
+    void *p;
+
+#ifdef THREAD_SAFE
+    thread_check();
+    if (size <= SLAB_MAX_SIZE) {
+        return tcache_alloc(size);
+    }
+#endif
+
+    ARENA_LOCK();
+    p = segregate_malloc(size);
+    ARENA_UNLOCK();
+
+    return p;
+}
+
+/**
+ *
+ * @param nmemb
+ * @param size
+ * @return
+ */
+void *segregate_mm_calloc(size_t nmemb, size_t size) {
+    void *p;
+
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        return NULL;
+    }
+    size *= nmemb;
+
+    /* small objects are cheaper to clear than to track */
+    if (size <= SLAB_MAX_SIZE) {
+        if ((p = segregate_mm_malloc(size)) != NULL) {
+            memset(p, 0, size);
+        }
+        return p;
+    }
+
+#ifdef THREAD_SAFE
+    thread_check();
+#endif
+    ARENA_LOCK();
+    p = segregate_calloc(size);
+    ARENA_UNLOCK();
+
+    return p;
+}
+
+/**
+ *
+ * @param alignment
+ * @param size
+ * @return
+ */
+void *segregate_mm_memalign(size_t alignment, size_t size) {
+    void *p;
+
+#ifdef THREAD_SAFE
+    thread_check();
+#endif
+    ARENA_LOCK();
+    p = segregate_memalign(alignment, size);
+    ARENA_UNLOCK();
+
+    return p;
 }
 
 /**
@@ -385,10 +2275,95 @@ void *segregate_mm_malloc(size_t size) {
  * @param ptr
  */
 void segregate_mm_free(void *ptr) {
-    freelist_insert(ptr);
+#ifdef THREAD_SAFE
+    arena_t *owner;
+#endif
+
+    if (MAP_OWNS(ptr)) {
+        map_free(ptr);
+        return;
+    }
+
+#ifdef THREAD_SAFE
+    thread_check();
+    if (SLAB_OWNS(ptr)) {
+        tcache_free(ptr);
+        return;
+    }
+
+    /* never wait for a lock to free, leave the block to its owner instead */
+    owner = ARENA_OF(ptr);
+    if (owner != home_arena || pthread_mutex_trylock(&owner->lock) != 0) {
+        arena_remote_free(owner, ptr);
+        return;
+    }
+    arena = owner;
+#endif
+
+    segregate_free(ptr);
+    ARENA_UNLOCK();
+}
+
+#ifdef DEBUG
+/**
+ * Check the size given to mm_free_sized() against the block
+ * @param ptr
+ * @param size
+ * @return 1 if the block holds size bytes, 0 if not
+ */
+static int sized_check(void *ptr, size_t size) {
+    size_t aval;
+
+    if (MAP_OWNS(ptr)) {
+        aval = MAP_AVAL_SIZE(ptr);
+    } else if (SLAB_OWNS(ptr)) {
+        aval = SLAB_RUNP(ptr)->size;
+    } else {
+        aval = BLK_AVAL_SIZE(ptr);
+    }
+
+    if (size > aval) {
+        fprintf(stderr, "freeing %zu bytes of a %zu-byte block! %p\n", size, aval, ptr);
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+/**
+ * Free ptr, whose size, as last given to malloc or realloc, the caller knows.
+ * a block too big for a slab slot skips the slab map, and its arena comes right from its header
+ * @param ptr
+ * @param size
+ */
+void segregate_mm_free_sized(void *ptr, size_t size) {
+#ifdef THREAD_SAFE
+    arena_t *owner;
+#endif
+
 #ifdef DEBUG
-    dump("free", BLK_AVAL_SIZE(ptr), ptr);
+    if (!sized_check(ptr, size)) {
+        segregate_mm_free(ptr);
+        return;
+    }
+#endif
+    if (size <= SLAB_MAX_SIZE || MAP_OWNS(ptr)) {
+        segregate_mm_free(ptr);
+        return;
+    }
+
+#ifdef THREAD_SAFE
+    thread_check();
+    owner = arenas + BLK_ARENA(ptr);
+    if (owner != home_arena || pthread_mutex_trylock(&owner->lock) != 0) {
+        arena_remote_free(owner, ptr);
+        return;
+    }
+    arena = owner;
 #endif
+
+    segregate_free_blk(ptr);
+    ARENA_UNLOCK();
 }
 
 /**
@@ -398,39 +2373,173 @@ void segregate_mm_free(void *ptr) {
  * @return
  */
 void *segregate_mm_realloc(void *ptr, size_t size) {
-    size_t asize, avasize;
-    void *np;
+    void *p;
 
     if (ptr == NULL) {
         return segregate_mm_malloc(size);
     }
 
-    if (size == 0) {
-        segregate_mm_free(ptr);
-        return NULL;
+    if (MAP_OWNS(ptr)) {
+        if (size == 0) {
+            map_free(ptr);
+            return NULL;
+        }
+        return map_realloc(ptr, size);
     }
 
-    asize = ALIGN(size), avasize = BLK_AVAL_SIZE(ptr);
+    ARENA_LOCK_OWNER(ptr);
+    p = segregate_realloc(ptr, size);
+    ARENA_UNLOCK();
 
-    /* need more space */
-    if (asize > avasize) {
-        np = segregate_mm_malloc(asize);
-        memcpy(np, ptr, BLK_AVAL_SIZE(ptr));
-        segregate_mm_free(ptr);
-        return np;
+    return p;
+}
+
+/**
+ * Bytes the block ptr can hold. only its own header is read, so no lock is needed
+ * @param ptr
+ * @return
+ */
+size_t segregate_mm_usable_size(void *ptr) {
+    return segregate_usable_size(ptr);
+}
+
+/**
+ * Grow the block ptr where it is, to hold min bytes at least and max bytes at most.
+ * a slab slot cannot grow past its class, nor a mapped block, which mem_remap() may move
+ * @param ptr
+ * @param min
+ * @param max
+ * @return the usable size of the block, or 0 if it cannot hold min bytes without moving
+ */
+size_t segregate_mm_try_expand(void *ptr, size_t min, size_t max) {
+    size_t size;
+
+    if (ptr == NULL || min > mem_maxheap()) {
+        return 0;
+    }
+    if ((size = segregate_usable_size(ptr)) >= min) {
+        return size;
+    }
+    if (MAP_OWNS(ptr) || SLAB_OWNS(ptr)) {
+        return 0;
     }
 
-    /* if shrink */
-    if (asize < avasize) {
-        /* need to insert the reminder to freelist */
-        if (avasize - asize >= BLK_MIN_SIZE) {
-            SET_BLK(ptr, asize + BLK_HDR_SIZE + BLK_FTR_SIZE, BLK_ALLOC);
-            SET_BLK(NEXT_BLKP(ptr), avasize - asize, BLK_FREE);
-            segregate_mm_free(NEXT_BLKP(ptr));
+    ARENA_LOCK_OWNER(ptr);
+    size = segregate_try_expand(ptr, min, max < mem_maxheap() ? max : mem_maxheap());
+    ARENA_UNLOCK();
+
+    return size;
+}
+
+/******************************************
+ * batches
+ ******************************************/
+
+/**
+ * Allocate n blocks of size bytes at once. they are carved, back to back, from a single
+ * block of the freelists. without one, the free blocks that fit a single block are taken
+ * first, as n mallocs would, and the rest is carved from a single extension of the heap,
+ * which takes in the free tailing block, see tail_malloc(). small and large requests,
+ * which already have their own fast paths, go one by one.
+ * @param size
+ * @param n
+ * @param out: the blocks
+ * @return the number of blocks allocated, n unless out of memory
+ */
+int segregate_mm_malloc_batch(size_t size, int n, void **out) {
+    void *p;
+    size_t bsize, rsize;
+    int i, j;
+
+    i = 0;
+    bsize = BLK_NEED_SIZE(size);
+    if (n > 1 && size > SLAB_MAX_SIZE && !MAP_HOLDS(size) && (size_t) n * bsize <= mem_maxheap()) {
+#ifdef THREAD_SAFE
+        thread_check();
+#endif
+        ARENA_LOCK();
+        if ((p = freelist_find(n * bsize - BLK_HDR_SIZE)) == NULL) {
+            /* once no free block fits, every other malloc would extend the heap too */
+            while (i < n && (p = freelist_find(size)) != NULL) {
+                out[i++] = p;
+            }
+            p = i < n ? tail_malloc((n - i) * bsize) : NULL;
+        }
+        if (p != NULL) {
+            /* the tail the freelists could not split off goes with the last block */
+            rsize = BLK_SIZE(p) - (n - i) * bsize;
+            SET_BLK(p, i == n - 1 ? bsize + rsize : bsize, BLK_ALLOC);
+            for (j = i; j < n; j++) {
+                if (j > i) {
+                    SET_BLK2(p, j == n - 1 ? bsize + rsize : bsize, BLK_ALLOC, BLK_ALLOC);
+                }
+                out[j] = p;
+                p += bsize;
+            }
+            i = n;
         }
+        ARENA_UNLOCK();
     }
 
-    return ptr;
+    for (; i < n && (out[i] = segregate_mm_malloc(size)) != NULL; i++);
+    return i;
+}
+
+/**
+ * Order of two block pointers, for qsort()
+ * @param a
+ * @param b
+ * @return
+ */
+static int ptr_cmp(const void *a, const void *b) {
+    char *p = *(char **) a, *q = *(char **) b;
+
+    return p < q ? -1 : p > q;
+}
+
+/**
+ * Free n blocks at once. they are sorted by address, so that blocks right after each other
+ * make a single free block, which is coalesced and put in the freelists only once.
+ * @param ptrs: the blocks, sorted in place
+ * @param n
+ */
+void segregate_mm_free_batch(void **ptrs, int n) {
+    void *p, *endp;
+    size_t size;
+    int i, j;
+
+    qsort(ptrs, n, sizeof(void *), ptr_cmp);
+
+    for (i = 0; i < n; i = j) {
+        p = ptrs[i];
+        j = i + 1;
+        if (p == NULL || MAP_OWNS(p) || SLAB_OWNS(p)) {
+            if (p != NULL) {
+                segregate_mm_free(p);
+            }
+            continue;
+        }
+
+        /* the run of blocks of the same arena that starts at p */
+        size = BLK_SIZE(p);
+        for (endp = p + size; j < n && ptrs[j] == endp && !SLAB_OWNS(endp) && BLK_ARENA(endp) == BLK_ARENA(p); j++) {
+            size += BLK_SIZE(endp);
+            endp += BLK_SIZE(endp);
+        }
+
+        if (j == i + 1) {
+            segregate_mm_free(p);
+            continue;
+        }
+
+#ifdef THREAD_SAFE
+        thread_check();
+#endif
+        ARENA_LOCK_OWNER(p);
+        SET_BLK(p, size, BLK_FREE);
+        freelist_insert(p);
+        ARENA_UNLOCK();
+    }
 }
 
 /******************************************
@@ -443,13 +2552,13 @@ void freelist_dump(char *msg, size_t size, void *p) {
     index = flt_index(size);
 
     printf("\n");
-    printf("after %s %d(0x%x) memory at %p:\n", msg, (int) size, (uint) size, p);
+    printf("after %s %zu(0x%zx) memory at %p:\n", msg, size, size, p);
     printf("==========================================================================================\n");
     printf("freelist_table:\n");
     for (i = 0; i < FLT_SLOT_NUM; i++) {
-        s = freelist_table + i;
+        s = arena->freelist_table + i;
 
-        if ((bp = (void *) *(uintptr_t *) (s)) == NULL) {
+        if ((bp = i == FLT_TREE_SLOT ? freetree_first() : NEXT_FREE_BLKP(s)) == NULL) {
             continue;
         }
 
@@ -457,10 +2566,23 @@ void freelist_dump(char *msg, size_t size, void *p) {
             printf("***");
         }
 
+        /* the tree in order of size */
         printf("slot [%zu]:\t", i);
-        while (bp) {
-            printf("%p(%u)\t", bp, BLK_AVAL_SIZE(bp));
-            bp = NEXT_FREE_BLKP(bp);
+        for (; bp != NULL;
+             bp = i == FLT_TREE_SLOT ? freetree_next(bp) : NEXT_FREE_BLKP(bp)) {
+            printf("%p(%zu)\t", bp, (size_t) BLK_AVAL_SIZE(bp));
+        }
+        printf("\n");
+    }
+    printf("fastbins:\n");
+    for (i = 0; i < FASTBIN_NUM && arena->fastbin != NULL; i++) {
+        if ((bp = arena->fastbin[i]) == NULL) {
+            continue;
+        }
+
+        printf("bin [%zu]:\t", i);
+        for (; bp != NULL; bp = *(void **) bp) {
+            printf("%p(%zu)\t", bp, (size_t) BLK_AVAL_SIZE(bp));
         }
         printf("\n");
     }
@@ -470,20 +2592,24 @@ void freelist_dump(char *msg, size_t size, void *p) {
 /******************************************
  * heap dumper
  ******************************************/
-void dump(char *msg, size_t size, void *p) {
+void segregate_dump(char *msg, size_t size, void *p) {
     void *s;
 
     s = heap_listp;
 
     printf("\n");
-    printf("after %s %d(0x%x) memory at %p:\n", msg, (int) size, (uint) size, p);
+    printf("after %s %zu(0x%zx) memory at %p:\n", msg, size, size, p);
     printf("==========================================================================================\n");
     while (s != NULL && !EB(s)) {
         printf("%s\t", BLK_STATE(s) ? "alloc" : "free");
-        printf("%8d(%8x)\t", BLK_SIZE(s), BLK_SIZE(s));
+        printf("%8zu(%8zx)\t", (size_t) BLK_SIZE(s), (size_t) BLK_SIZE(s));
         printf("%p --- ", s);
         printf("%p\t", s + BLK_SIZE(s) - 1);
-        printf("%8x\t%8x\n", GET(BLK_HDRP(s)), GET(BLK_FTRP(s)));
+        if (BLK_STATE(s)) {
+            printf("%8zx\n", (size_t) GET(BLK_HDRP(s)));
+        } else {
+            printf("%8zx\t%8zx\n", (size_t) GET(BLK_HDRP(s)), (size_t) GET(BLK_FTRP(s)));
+        }
 
         s = NEXT_BLKP(s);
     }
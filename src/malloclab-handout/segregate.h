@@ -10,7 +10,14 @@ extern void *mm_realloc(void *ptr, size_t size);
 
 int segregate_mm_init(void);
 void *segregate_mm_malloc(size_t size);
+void *segregate_mm_calloc(size_t nmemb, size_t size);
+void *segregate_mm_memalign(size_t alignment, size_t size);
 void segregate_mm_free(void *ptr);
+void segregate_mm_free_sized(void *ptr, size_t size);
 void *segregate_mm_realloc(void *ptr, size_t size);
+size_t segregate_mm_usable_size(void *ptr);
+size_t segregate_mm_try_expand(void *ptr, size_t min, size_t max);
+int segregate_mm_malloc_batch(size_t size, int n, void **out);
+void segregate_mm_free_batch(void **ptrs, int n);
 
 #endif //_SEGREGATE_H
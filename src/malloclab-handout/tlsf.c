@@ -0,0 +1,687 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tlsf.h"
+#include "memlib.h"
+#include "utils.h"
+
+#include "config.h"
+
+/* the smallest block's size we maintain, doubly linked when free, see NEXT_FREE_BLKP() */
+#define BLK_MIN_SIZE    (BLK_HDR_SIZE + ALIGNMENT + BLK_FTR_SIZE)
+
+/* block size to alloc size bytes, no footer, but big enough to be a free block later */
+#define BLK_NEED_SIZE(size) (ALIGN((size) + BLK_HDR_SIZE) < BLK_MIN_SIZE ? BLK_MIN_SIZE : ALIGN((size) + BLK_HDR_SIZE))
+
+#define BLK_FREE    0
+#define BLK_ALLOC   1
+
+/* boundary tags as in segregate: only free blocks have a footer, bit 1 of a header tells if
+ * the previous block is alloced, so that coalesce() knows whether there is a footer to look for.
+ *
+ * alloc:   |hdr|          payload          |
+ * free:    |hdr|next|prev|     ......  |ftr|
+ * */
+#define PACK(size, prev_alloc, alloc)   ((size) | ((prev_alloc) << 1) | (alloc))
+
+#define GET(p)          (*(unsigned int*)(p))
+#define SET(p, val)     (*(unsigned int*)(p) = (val))
+
+#define GET_SIZE(p)         (GET(p) & ~0x7)
+#define GET_ALLOC(p)        (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p)   ((GET(p) >> 1) & 0x1)
+
+/* bit 2 of an alloc block header is set once the block has grown on realloc, see GROW_SIZE().
+ * any SET_BLK() clears it */
+#define BLK_GROWN_BIT       0x4
+#define BLK_GROWN(p)        (GET(BLK_HDRP(p)) & BLK_GROWN_BIT)
+#define SET_GROWN(p)        SET(BLK_HDRP(p), GET(BLK_HDRP(p)) | BLK_GROWN_BIT)
+
+/* padding block */
+#define PADDING_BLK_SIZE    4
+
+/* prologue block */
+#define PB_HDR_SIZE     4
+#define PB_FTR_SIZE     4
+
+/* epilogue block */
+#define EB_HDR_SIZE     4
+
+#define EB_HDRP(p)      ((void*)(p) - EB_HDR_SIZE)          /* epilogue block header pointer */
+#define EB(p)           (BLK_SIZE(p) == 0 && BLK_STATE(p))  /* does p point to a epilogue block? */
+
+#define BLK_HDR_SIZE    4
+#define BLK_FTR_SIZE    4
+
+#define BLK_SIZE(p)             GET_SIZE(BLK_HDRP(p))
+#define BLK_AVAL_SIZE(p)        (BLK_SIZE(p) - BLK_HDR_SIZE)        /* available memory size once alloced */
+#define BLK_STATE(p)            (GET_ALLOC(BLK_HDRP(p)))            /* is the block alloced? */
+
+#define BLK_HDRP(p)             ((void*)(p) - BLK_HDR_SIZE)
+#define BLK_FTRP(p)             ((void*)(p) + BLK_SIZE(p) - BLK_HDR_SIZE - BLK_FTR_SIZE)  /* free blocks only */
+
+/* set the block p, whose header is already in place, keeping the alloc state of its prev block */
+#define SET_BLK(p, size, alloc)     SET_BLK2(p, size, PREV_BLK_ALLOC(p), alloc)
+
+/* set the block p from scratch */
+#define SET_BLK2(p, size, prev_alloc, alloc)    do {        \
+    SET(BLK_HDRP(p), PACK(size, prev_alloc, alloc));        \
+    if ((alloc) == BLK_FREE) {                              \
+        SET(BLK_FTRP(p), PACK(size, 0, alloc));             \
+    } } while(0)
+
+/* pointer calculation */
+#define PREV_BLKP(p)    ((void*)(p) - PREV_BLK_SIZE(p))    /* prev block pointer, if it is free */
+#define NEXT_BLKP(p)    ((void*)(p) + BLK_SIZE(p))          /* next block pointer */
+
+#define NEXT_HDRP(p)    BLK_HDRP((void*)(p) + BLK_SIZE(p))            /* next block header pointer */
+#define PREV_FTRP(p)    ((void*)(p) - BLK_HDR_SIZE - BLK_FTR_SIZE)    /* prev block footer pointer, if it is free */
+
+/* block info */
+#define PREV_BLK_ALLOC(p)   GET_PREV_ALLOC(BLK_HDRP(p))
+#define PREV_BLK_SIZE(p)    GET_SIZE(PREV_FTRP(p))
+#define NEXT_BLK_ALLOC(p)   GET_ALLOC(NEXT_HDRP(p))
+#define NEXT_BLK_SIZE(p)    GET_SIZE(NEXT_HDRP(p))
+
+/* two level segregated fit: the first level splits block sizes by powers of two, the second level
+ * splits every power of two into SL_NUM linear classes. block sizes under SMALL_BLK_SIZE are all
+ * in the first level, their classes 8 bytes apart. a bit per level tells which classes are
+ * not empty, so that finding a class with a block big enough, and so a block, is a couple of
+ * ffs, without walking any list.
+ * SL_BITS 4: fl 0 {0-7, 8-15, ..., 120-127}, fl 1 {128-135, ..., 248-255}, fl 2 {256-271, ...}
+ * */
+#define SL_BITS         4
+#define SL_NUM          (1 << SL_BITS)
+#define FL_SHIFT        (SL_BITS + 3)                   /* ALIGNMENT is 1 << 3 */
+#define SMALL_BLK_SIZE  (1 << FL_SHIFT)
+#define FL_MAX          25                              /* block sizes are under 32MB, and MAX_HEAP */
+#define FL_NUM          (FL_MAX - FL_SHIFT + 1)
+
+/* free block pointers: 32 bit offsets from the prologue block, so that even a BLK_MIN_SIZE
+ * block has room for both links. offset 0 is NULL, no free block lives there */
+#define FREE_OFFSET(p)          ((p) == NULL ? 0 : (unsigned int) ((char *) (p) - (char *) heap_listp))
+#define FREE_PTR(off)           ((off) == 0 ? NULL : (void *) ((char *) heap_listp + (off)))
+
+#define NEXT_FREE_BLKP(p)       FREE_PTR(*(unsigned int *) (p))
+#define PREV_FREE_BLKP(p)       FREE_PTR(*((unsigned int *) (p) + 1))
+
+#define SET_NEXT_FREE_BLK(bp, next)    (*(unsigned int *) (bp) = FREE_OFFSET(next))
+#define SET_PREV_FREE_BLK(bp, prev)    (*((unsigned int *) (bp) + 1) = FREE_OFFSET(prev))
+
+void tlsf_dump(char *msg, size_t size, void *p);
+
+static void *tlsf_malloc(size_t size);
+
+static void *map_alloc(size_t size);
+
+static void *map_realloc(void *ptr, size_t size);
+
+static void map_free(void *ptr);
+
+static void *heap_listp;                    /* the prologue block */
+static void *tlsf_table[FL_NUM][SL_NUM];    /* first free block of every class */
+static unsigned int fl_map;                 /* bit i is set if some class of level i is not empty */
+static unsigned int sl_map[FL_NUM];         /* bit j of sl_map[i] is set if tlsf_table[i][j] is not empty */
+
+#ifdef THREAD_SAFE
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;     /* guards the whole heap */
+#endif
+
+/******************************************
+ * class functions
+ ******************************************/
+
+/**
+ * The class of a free block of bsize bytes
+ * @param bsize
+ * @param flp
+ * @param slp
+ */
+void tlsf_mapping(size_t bsize, int *flp, int *slp) {
+    int k;
+
+    if (bsize < SMALL_BLK_SIZE) {
+        *flp = 0;
+        *slp = bsize / ALIGNMENT;
+        return;
+    }
+
+    /* bsize in [2^k, 2^(k+1)), and SL_BITS bits below the leading one pick the class */
+    k = 63 - __builtin_clzll(bsize);
+    *flp = k - FL_SHIFT + 1;
+    *slp = (bsize >> (k - SL_BITS)) ^ SL_NUM;
+}
+
+/**
+ * The first class all of whose blocks are at least bsize bytes
+ * @param bsize
+ * @param flp
+ * @param slp
+ */
+void tlsf_mapping_search(size_t bsize, int *flp, int *slp) {
+    if (bsize >= SMALL_BLK_SIZE) {
+        bsize += ((size_t) 1 << (63 - __builtin_clzll(bsize) - SL_BITS)) - 1;
+    }
+    tlsf_mapping(bsize, flp, slp);
+}
+
+/**
+ *
+ * @param bp a free block, tagged
+ */
+void tlsf_insert(void *bp) {
+    void *nextp;
+    int fl, sl;
+
+#ifdef DEBUG
+    if (BLK_STATE(bp) != BLK_FREE) {
+        fprintf(stderr, "freeing a alloc block! %p\n", bp);
+        exit(0);
+    }
+#endif
+
+    tlsf_mapping(BLK_SIZE(bp), &fl, &sl);
+    nextp = tlsf_table[fl][sl];
+    SET_NEXT_FREE_BLK(bp, nextp);
+    SET_PREV_FREE_BLK(bp, NULL);
+    if (nextp != NULL) {
+        SET_PREV_FREE_BLK(nextp, bp);
+    }
+    tlsf_table[fl][sl] = bp;
+    fl_map |= 1u << fl;
+    sl_map[fl] |= 1u << sl;
+}
+
+/**
+ *
+ * @param bp a free block in its class
+ */
+void tlsf_del(void *bp) {
+    void *prevp, *nextp;
+    int fl, sl;
+
+    prevp = PREV_FREE_BLKP(bp);
+    nextp = NEXT_FREE_BLKP(bp);
+    if (nextp != NULL) {
+        SET_PREV_FREE_BLK(nextp, prevp);
+    }
+    if (prevp != NULL) {
+        SET_NEXT_FREE_BLK(prevp, nextp);
+        return;
+    }
+
+    tlsf_mapping(BLK_SIZE(bp), &fl, &sl);
+    if ((tlsf_table[fl][sl] = nextp) == NULL) {
+        if ((sl_map[fl] &= ~(1u << sl)) == 0) {
+            fl_map &= ~(1u << fl);
+        }
+    }
+}
+
+/**
+ * Take a free block of bsize bytes at least out of its class
+ * @param bsize
+ * @return the free block, or NULL if none
+ */
+void *tlsf_find(size_t bsize) {
+    unsigned int map;
+    int fl, sl;
+    void *bp;
+
+    tlsf_mapping_search(bsize, &fl, &sl);
+    if (fl >= FL_NUM) {
+        return NULL;
+    }
+
+    /* a larger class of the same level, or the first class of a larger level */
+    if ((map = sl_map[fl] & (~0u << sl)) == 0) {
+        if (fl + 1 >= FL_NUM || (map = fl_map & (~0u << (fl + 1))) == 0) {
+            return NULL;
+        }
+        fl = __builtin_ctz(map);
+        map = sl_map[fl];
+    }
+    sl = __builtin_ctz(map);
+
+    bp = tlsf_table[fl][sl];
+    tlsf_del(bp);
+    return bp;
+}
+
+/******************************************
+ * heap functions
+ ******************************************/
+
+/**
+ * Extend the heap
+ * @param size
+ *              NOTE: it is caller's duty to rounds up to the nearest multiple of ALIGNMENT, and
+ *                    it is caller's duty to calculate the header and footer within size
+ * @return the address of free memory, which is an alloc block, or NULL if failed
+ */
+void *tlsf_extend(size_t size) {
+#ifdef DEBUG
+    printf("[DEBUG] in tlsf_extend(), size = %zu\n", size);
+#endif
+
+    void *old_brk;
+
+    /* FL_MAX covers MAX_HEAP, however large mem_maxheap() is */
+    if (size > MAX_HEAP - mem_heapsize()) {
+        return NULL;
+    }
+    if ((old_brk = mem_sbrk(size)) == (void *) -1) {
+        return NULL;
+    }
+
+    /* the old epilogue becomes the header of the new block */
+    SET_BLK2(old_brk, size, GET_PREV_ALLOC(EB_HDRP(old_brk)), BLK_ALLOC);
+    SET(EB_HDRP(mem_sbrk(0)), PACK(0, BLK_ALLOC, BLK_ALLOC));
+    return old_brk;
+}
+
+/**
+ * Tell the block bp whether its prev block is alloced
+ * @param bp
+ * @param prev_alloc
+ */
+void tlsf_set_prev_alloc(void *bp, int prev_alloc) {
+    SET(BLK_HDRP(bp), (GET(BLK_HDRP(bp)) & ~0x2) | (prev_alloc << 1));
+}
+
+/**
+ *
+ * @param bp a free block, not in any class
+ * @return the coalesced block, not in any class either
+ */
+void *tlsf_coalesce(void *bp) {
+    size_t size;
+    void *p;
+
+    size = BLK_SIZE(bp);
+    p = bp;
+
+    if (NEXT_BLK_ALLOC(bp) == BLK_FREE) {
+        tlsf_del(NEXT_BLKP(bp));
+        size += NEXT_BLK_SIZE(bp);
+    }
+
+    /* the prev block has a footer to look at only if it is free */
+    if (PREV_BLK_ALLOC(bp) == BLK_FREE) {
+        p = PREV_BLKP(bp);
+        tlsf_del(p);
+        size += BLK_SIZE(p);
+    }
+
+    SET_BLK(p, size, BLK_FREE);
+    tlsf_set_prev_alloc(NEXT_BLKP(p), BLK_FREE);
+    return p;
+}
+
+/**
+ * Give the tailing free block p back to memlib, but for TRIM_PAD bytes of it
+ * @param p: a free block, not in any class yet
+ */
+void tlsf_trim(void *p) {
+    if (mem_sbrk(-(intptr_t) (BLK_SIZE(p) - TRIM_PAD)) != (void *) -1) {
+#ifdef DEBUG
+        printf("[DEBUG] in tlsf_trim(), size = %d\n", BLK_SIZE(p) - TRIM_PAD);
+#endif
+        SET_BLK(p, TRIM_PAD, BLK_FREE);
+        SET(EB_HDRP(mem_sbrk(0)), PACK(0, BLK_FREE, BLK_ALLOC));
+    }
+}
+
+/**
+ * Use the first nsize bytes of the block p, and give the reminder back to its class
+ * @param p an alloc block
+ * @param bsize its size
+ * @param nsize
+ */
+void tlsf_place(void *p, size_t bsize, size_t nsize) {
+    if (bsize - nsize >= BLK_MIN_SIZE) {
+        SET_BLK(p, nsize, BLK_ALLOC);
+        SET_BLK2(NEXT_BLKP(p), bsize - nsize, BLK_ALLOC, BLK_FREE);
+        tlsf_insert(tlsf_coalesce(NEXT_BLKP(p)));
+    } else {
+        SET_BLK(p, bsize, BLK_ALLOC);
+        tlsf_set_prev_alloc(NEXT_BLKP(p), BLK_ALLOC);
+    }
+}
+
+/**
+ * Grow the block ptr to nsize bytes where it is, into the free next block, or beyond the brk
+ * @param ptr
+ * @param nsize: block size needed, larger than the current one
+ * @param gsize: block size wanted, with headroom, no less than nsize
+ * @return ptr, or NULL if it cannot grow in place
+ */
+void *tlsf_grow(void *ptr, size_t nsize, size_t gsize) {
+    void *nbp, *tailp;
+    size_t bsize, fsize;
+
+    bsize = BLK_SIZE(ptr);
+    nbp = NEXT_BLKP(ptr);
+    fsize = NEXT_BLK_ALLOC(ptr) == BLK_FREE ? BLK_SIZE(nbp) : 0;
+
+    if (bsize + fsize < nsize) {
+        tailp = fsize != 0 ? NEXT_BLKP(nbp) : nbp;
+        if (!EB(tailp) || tlsf_extend(nsize - bsize - fsize) == NULL) {
+            return NULL;
+        }
+        if (fsize != 0) {
+            tlsf_del(nbp);
+        }
+        fsize = nsize - bsize;
+    } else if (fsize != 0) {
+        tlsf_del(nbp);
+    }
+
+    tlsf_place(ptr, bsize + fsize, bsize + fsize < gsize ? bsize + fsize : gsize);
+    return ptr;
+}
+
+/******************************************
+ * allocator core
+ * NOTE: callers must hold the heap_lock
+ ******************************************/
+
+/**
+ *
+ * @return
+ */
+static int tlsf_init(void) {
+    // 1. extend the heap for padding, pb, and eb;
+    // 2. empty all the classes.
+    if ((heap_listp = mem_sbrk(PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE + EB_HDR_SIZE)) == (void *) -1) {
+        return 1;
+    }
+
+    SET(heap_listp, 0xDEADBEEF);        /* padding block */
+    SET(heap_listp + PADDING_BLK_SIZE, PACK(8, BLK_ALLOC, BLK_ALLOC));     /* prologue block header */
+    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE, PACK(8, BLK_ALLOC, BLK_ALLOC));   /* prologue block footer */
+    SET(heap_listp + PADDING_BLK_SIZE + PB_HDR_SIZE + PB_FTR_SIZE, PACK(0, BLK_ALLOC, BLK_ALLOC)); /* epilogue block header */
+
+    heap_listp += PADDING_BLK_SIZE + PB_HDR_SIZE;
+
+    memset(tlsf_table, 0, sizeof(tlsf_table));
+    memset(sl_map, 0, sizeof(sl_map));
+    fl_map = 0;
+
+    return 0;
+}
+
+/**
+ *
+ * @param size
+ * @return
+ */
+static void *tlsf_malloc(size_t size) {
+    // 1. take a block from the first non-empty class all of whose blocks are big enough;
+    // 2. if none, extend the heap, by just what is missing if the tailing block is free;
+    // 3. split the reminder off.
+    void *bp, *brk;
+    size_t nsize, bsize;
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    /* large blocks stay out of the heap */
+    if (MAP_HOLDS(size)) {
+        return map_alloc(size);
+    }
+
+    nsize = BLK_NEED_SIZE(size);
+    if ((bp = tlsf_find(nsize)) != NULL) {
+        tlsf_place(bp, BLK_SIZE(bp), nsize);
+#ifdef DUMP_HEAP
+        tlsf_dump("alloc", size, bp);
+#endif
+        return bp;
+    }
+
+    /* the tailing free block may be big enough even if its class is not */
+    brk = mem_sbrk(0);
+    if (GET_PREV_ALLOC(EB_HDRP(brk)) == BLK_FREE) {
+        bp = PREV_BLKP(brk);
+        bsize = BLK_SIZE(bp);
+        if (bsize < nsize && tlsf_extend(nsize - bsize) == NULL) {
+            return NULL;
+        }
+        tlsf_del(bp);
+        tlsf_place(bp, bsize < nsize ? nsize : bsize, nsize);
+    } else if ((bp = tlsf_extend(nsize)) == NULL) {
+        return NULL;
+    }
+
+#ifdef DUMP_HEAP
+    tlsf_dump("alloc from heap", size, bp);
+#endif
+    return bp;
+}
+
+/**
+ *
+ * @param ptr
+ */
+static void tlsf_free(void *ptr) {
+    void *p;
+
+    if (MAP_OWNS(ptr)) {
+        map_free(ptr);
+        return;
+    }
+
+    SET_BLK(ptr, BLK_SIZE(ptr), BLK_FREE);
+    p = tlsf_coalesce(ptr);
+#if TRIM_THRESHOLD > 0
+    if (BLK_SIZE(p) > TRIM_THRESHOLD && EB(NEXT_BLKP(p))) {
+        tlsf_trim(p);
+    }
+#endif
+    tlsf_insert(p);
+#ifdef DUMP_HEAP
+    tlsf_dump("free", BLK_AVAL_SIZE(p), p);
+#endif
+}
+
+/**
+ *
+ * @param ptr
+ * @param size
+ * @return
+ */
+static void *tlsf_realloc(void *ptr, size_t size) {
+    size_t nsize, bsize, gsize;
+    void *np;
+
+    if (ptr == NULL) {
+        return tlsf_malloc(size);
+    }
+
+    if (size == 0) {
+        tlsf_free(ptr);
+        return NULL;
+    }
+
+    if (MAP_OWNS(ptr)) {
+        return map_realloc(ptr, size);
+    }
+
+    nsize = BLK_NEED_SIZE(size), bsize = BLK_SIZE(ptr);
+
+    /* need more space, copy only if the block cannot grow where it is.
+     * a block growing again gets some headroom, see GROW_SIZE() */
+    if (nsize > bsize) {
+        gsize = BLK_GROWN(ptr) ? GROW_SIZE(bsize, nsize) : nsize;
+        if (!MAP_HOLDS(size) && tlsf_grow(ptr, nsize, gsize) != NULL) {
+            SET_GROWN(ptr);
+            return ptr;
+        }
+        if ((np = tlsf_malloc(gsize - BLK_HDR_SIZE)) == NULL) {
+            return NULL;
+        }
+        memcpy(np, ptr, BLK_AVAL_SIZE(ptr));
+        tlsf_free(ptr);
+        if (!MAP_OWNS(np)) {
+            SET_GROWN(np);
+        }
+        return np;
+    }
+
+    /* still within the headroom of a grown block */
+    if (BLK_GROWN(ptr) && GROW_KEEPS(bsize, nsize)) {
+        return ptr;
+    }
+
+    tlsf_place(ptr, bsize, nsize);
+    return ptr;
+}
+
+/******************************************
+ * mapped blocks
+ * NOTE: callers must hold the heap_lock
+ ******************************************/
+
+/**
+ * Map a region of its own for a large block
+ * @param size
+ * @return the payload, or NULL if failed
+ */
+static void *map_alloc(size_t size) {
+    void *p;
+    size_t len;
+
+    len = MAP_NEED_LEN(size);
+    if ((p = mem_map(len)) == (void *) -1) {
+        return NULL;
+    }
+    p += MAP_HDR_SIZE;
+    MAP_LEN(p) = len;
+    return p;
+}
+
+/**
+ * Give the whole region of a mapped block back
+ * @param ptr
+ */
+static void map_free(void *ptr) {
+    mem_unmap(ptr - MAP_HDR_SIZE);
+}
+
+/**
+ * Resize a mapped block: remap it while it is still large, or move it into the heap
+ * @param ptr
+ * @param size
+ * @return
+ */
+static void *map_realloc(void *ptr, size_t size) {
+    void *p;
+    size_t len;
+
+    if (MAP_HOLDS(size)) {
+        if ((len = MAP_NEED_LEN(size)) == MAP_LEN(ptr)) {
+            return ptr;
+        }
+        if ((p = mem_remap(ptr - MAP_HDR_SIZE, len)) == (void *) -1) {
+            return NULL;
+        }
+        p += MAP_HDR_SIZE;
+        MAP_LEN(p) = len;
+        return p;
+    }
+
+    if ((p = tlsf_malloc(size)) == NULL) {
+        return NULL;
+    }
+    memcpy(p, ptr, size);
+    map_free(ptr);
+    return p;
+}
+
+/******************************************
+ * allocator open APIs
+ ******************************************/
+
+/**
+ *
+ * @return
+ */
+int tlsf_mm_init(void) {
+    int ret;
+
+    MM_LOCK(&heap_lock);
+    ret = tlsf_init();
+    MM_UNLOCK(&heap_lock);
+
+    return ret;
+}
+
+/**
+ *
+ * @param size
+ * @return
+ */
+void *tlsf_mm_malloc(size_t size) {
+    void *p;
+
+    MM_LOCK(&heap_lock);
+    p = tlsf_malloc(size);
+    MM_UNLOCK(&heap_lock);
+
+    return p;
+}
+
+/**
+ *
+ * @param ptr
+ */
+void tlsf_mm_free(void *ptr) {
+    MM_LOCK(&heap_lock);
+    tlsf_free(ptr);
+    MM_UNLOCK(&heap_lock);
+}
+
+/**
+ *
+ * @param ptr
+ * @param size
+ * @return
+ */
+void *tlsf_mm_realloc(void *ptr, size_t size) {
+    void *p;
+
+    MM_LOCK(&heap_lock);
+    p = tlsf_realloc(ptr, size);
+    MM_UNLOCK(&heap_lock);
+
+    return p;
+}
+
+/******************************************
+ * class dumper
+ ******************************************/
+void tlsf_dump(char *msg, size_t size, void *p) {
+    void *bp;
+    int fl, sl;
+
+    printf("\n");
+    printf("after %s %d(0x%x) memory at %p:\n", msg, (int) size, (int) size, p);
+    printf("==========================================================================================\n");
+    for (fl = 0; fl < FL_NUM; fl++) {
+        for (sl = 0; sl < SL_NUM; sl++) {
+            if ((bp = tlsf_table[fl][sl]) == NULL) {
+                continue;
+            }
+
+            printf("class [%d][%d]:\t", fl, sl);
+            for (; bp != NULL; bp = NEXT_FREE_BLKP(bp)) {
+                printf("%p(%d)\t", bp, BLK_SIZE(bp));
+            }
+            printf("\n");
+        }
+    }
+    printf("==========================================================================================\n");
+}
@@ -0,0 +1,16 @@
+#ifndef _TLSF_H
+#define _TLSF_H
+
+#include <stdlib.h>
+
+extern int mm_init (void);
+extern void *mm_malloc (size_t size);
+extern void mm_free (void *ptr);
+extern void *mm_realloc(void *ptr, size_t size);
+
+int tlsf_mm_init(void);
+void *tlsf_mm_malloc(size_t size);
+void tlsf_mm_free(void *ptr);
+void *tlsf_mm_realloc(void *ptr, size_t size);
+
+#endif //_TLSF_H
@@ -1,13 +1,64 @@
 #ifndef _UTILS_H
 #define _UTILS_H
 
+#include <stdint.h>
+
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8
 
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
 
-
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
+/* block metadata word of implicit and segregate: a header or a footer packs the block size with
+ * its state bits in one, and so does a free link of segregate. 32 bits cap the heap, as no block
+ * may outgrow its size field, see their init. BLK_WORD64 lifts the cap for 8 more bytes a block */
+#ifdef BLK_WORD64
+typedef uint64_t blk_word_t;
+#else
+typedef uint32_t blk_word_t;
+#endif
+#define BLK_WORD_SIZE   sizeof(blk_word_t)
+
+/* heap trimming: a free block at the top of the heap larger than TRIM_THRESHOLD bytes is cut
+ * down to TRIM_PAD bytes and the rest goes back to memlib. the gap between the two keeps a
+ * heap that grows and shrinks around the same size from moving the brk every time. 0 disables it */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD  (128 * 1024)
+#endif
+#define TRIM_PAD        ALIGN(TRIM_THRESHOLD / 2)
+
+/* large blocks: a request over MAP_THRESHOLD bytes gets a region of its own from mem_map(), outside
+ * the brk heap, and the whole region goes back with mem_unmap() once freed. the region length sits
+ * in the word before the payload, and a mapped payload is told apart by its address. 0 never maps
+ *
+ * mapped:  |len|          payload          |
+ * */
+#ifndef MAP_THRESHOLD
+#define MAP_THRESHOLD   (128 * 1024)
+#endif
+#define MAP_HDR_SIZE        SIZE_T_SIZE
+#define MAP_HOLDS(size)     (MAP_THRESHOLD > 0 && (size) > MAP_THRESHOLD)          /* should size bytes be mapped? */
+#define MAP_OWNS(p)         ((size_t) ((char *) (p) - (char *) mem_heap_lo()) >= mem_maxheap())  /* is p mapped? */
+#define MAP_LEN(p)          (*(size_t *) ((char *) (p) - MAP_HDR_SIZE))        /* length of the region of p */
+#define MAP_AVAL_SIZE(p)    (MAP_LEN(p) - MAP_HDR_SIZE)
+#define MAP_NEED_LEN(size)  (((size) + MAP_HDR_SIZE + mem_pagesize() - 1) & ~(mem_pagesize() - 1))
+
+/* realloc headroom: a block growing for the second time is likely to keep on growing, so it gets
+ * half of its size more than it needs, and keeps the slack while it is reallocated within it.
+ * a real shrink, where GROW_KEEPS fails, or a free gives the slack back */
+#define GROW_SIZE(bsize, nsize)     (ALIGN((bsize) + (bsize) / 2) > (nsize) ? ALIGN((bsize) + (bsize) / 2) : (nsize))
+#define GROW_KEEPS(bsize, nsize)    (3 * (nsize) >= 2 * (bsize))
+
+/* heap lock, only in a thread safe build */
+#ifdef THREAD_SAFE
+#include <pthread.h>
+#define MM_LOCK(m)      pthread_mutex_lock(m)
+#define MM_UNLOCK(m)    pthread_mutex_unlock(m)
+#else
+#define MM_LOCK(m)
+#define MM_UNLOCK(m)
+#endif
+
 #endif //_UTILS_H